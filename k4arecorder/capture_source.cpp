@@ -0,0 +1,578 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "capture_source.h"
+#include "recorder.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+// Device timestamps of a real device start a little after the cameras do; keep synthetic ones away from zero too.
+static const uint64_t syntheticTimestampOffsetUsec = 200000;
+static const uint64_t syntheticImuPeriodUsec = 5000;
+
+static std::atomic<int64_t> syntheticLiveImages(0);
+
+static void synthetic_free_buffer(void *buffer, void *context)
+{
+    (void)context; // Unused
+    free(buffer);
+    syntheticLiveImages--;
+}
+
+// Allocates the buffer itself, so that releasing the image can be counted.
+static k4a_image_t create_synthetic_image(k4a_image_format_t format, int width, int height, int stride, size_t size)
+{
+    uint8_t *buffer = (uint8_t *)malloc(size);
+    if (buffer == NULL)
+    {
+        return NULL;
+    }
+    k4a_image_t image = NULL;
+    if (K4A_FAILED(k4a_image_create_from_buffer(
+            format, width, height, stride, buffer, size, synthetic_free_buffer, NULL, &image)))
+    {
+        free(buffer);
+        return NULL;
+    }
+    syntheticLiveImages++;
+    return image;
+}
+
+device_capture_source::device_capture_source(k4a_device_t device) : m_device(device) {}
+
+device_capture_source::~device_capture_source()
+{
+    k4a_device_close(m_device);
+}
+
+k4a_device_t device_capture_source::device() const
+{
+    return m_device;
+}
+
+k4a_result_t device_capture_source::start_cameras(const k4a_device_configuration_t *device_config)
+{
+    return k4a_device_start_cameras(m_device, device_config);
+}
+
+void device_capture_source::stop_cameras()
+{
+    k4a_device_stop_cameras(m_device);
+}
+
+k4a_result_t device_capture_source::start_imu()
+{
+    return k4a_device_start_imu(m_device);
+}
+
+void device_capture_source::stop_imu()
+{
+    k4a_device_stop_imu(m_device);
+}
+
+k4a_wait_result_t device_capture_source::get_capture(k4a_capture_t *capture, int32_t timeout_ms)
+{
+    return k4a_device_get_capture(m_device, capture, timeout_ms);
+}
+
+k4a_wait_result_t device_capture_source::get_imu_sample(k4a_imu_sample_t *sample, int32_t timeout_ms)
+{
+    return k4a_device_get_imu_sample(m_device, sample, timeout_ms);
+}
+
+synthetic_capture_source::synthetic_capture_source() :
+    m_device_config(K4A_DEVICE_CONFIG_INIT_DISABLE_ALL),
+    m_cameras_started(false),
+    m_imu_started(false),
+    m_frame_index(0),
+    m_imu_index(0),
+    m_frame_period(0)
+{
+}
+
+k4a_device_t synthetic_capture_source::device() const
+{
+    return NULL;
+}
+
+k4a_result_t synthetic_capture_source::start_cameras(const k4a_device_configuration_t *device_config)
+{
+    uint32_t camera_fps = k4a_convert_fps_to_uint(device_config->camera_fps);
+    if (camera_fps == 0)
+    {
+        return K4A_RESULT_FAILED;
+    }
+    m_device_config = *device_config;
+    m_frame_period = std::chrono::microseconds(1000000 / camera_fps);
+    m_frame_index = 0;
+    m_imu_index = 0;
+    m_start_time = std::chrono::steady_clock::now();
+    m_cameras_started = true;
+    return K4A_RESULT_SUCCEEDED;
+}
+
+void synthetic_capture_source::stop_cameras()
+{
+    m_cameras_started = false;
+}
+
+k4a_result_t synthetic_capture_source::start_imu()
+{
+    if (!m_cameras_started)
+    {
+        return K4A_RESULT_FAILED;
+    }
+    m_imu_started = true;
+    return K4A_RESULT_SUCCEEDED;
+}
+
+void synthetic_capture_source::stop_imu()
+{
+    m_imu_started = false;
+}
+
+int64_t synthetic_capture_source::live_images()
+{
+    return syntheticLiveImages;
+}
+
+k4a_image_t synthetic_capture_source::create_depth_image(k4a_image_format_t format, uint64_t device_timestamp_usec)
+{
+    int width, height;
+    if (!get_depth_mode_size(m_device_config.depth_mode, &width, &height))
+    {
+        return NULL;
+    }
+    int stride = width * (int)sizeof(uint16_t);
+    k4a_image_t image = create_synthetic_image(format, width, height, stride, (size_t)stride * height);
+    if (image == NULL)
+    {
+        return NULL;
+    }
+
+    // A floor-to-wall gradient with a square "subject" crossing the view every few seconds.
+    uint16_t *pixels = (uint16_t *)k4a_image_get_buffer(image);
+    int size = height / 4;
+    int object_x = (int)((m_frame_index * 4) % (uint64_t)(width + size)) - size;
+    int object_y = (height - size) / 2;
+    for (int y = 0; y < height; y++)
+    {
+        uint16_t background = (uint16_t)(format == K4A_IMAGE_FORMAT_DEPTH16 ? 3000 - y : 200 + y / 4);
+        uint16_t *row = pixels + (size_t)y * width;
+        for (int x = 0; x < width; x++)
+        {
+            bool object = x >= object_x && x < object_x + size && y >= object_y && y < object_y + size;
+            row[x] = object ? (uint16_t)(format == K4A_IMAGE_FORMAT_DEPTH16 ? 1500 : 900) : background;
+        }
+    }
+
+    k4a_image_set_device_timestamp_usec(image, device_timestamp_usec);
+    k4a_image_set_system_timestamp_nsec(
+        image,
+        (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+    return image;
+}
+
+k4a_image_t synthetic_capture_source::create_color_image(uint64_t device_timestamp_usec)
+{
+    int width, height;
+    if (!get_color_resolution_size(m_device_config.color_resolution, &width, &height))
+    {
+        return NULL;
+    }
+
+    k4a_image_t image = NULL;
+    switch (m_device_config.color_format)
+    {
+    case K4A_IMAGE_FORMAT_COLOR_MJPG:
+    {
+        // Not a decodable JPEG, only framed like one and sized like a typical compressed frame.
+        size_t size = (size_t)width * height / 8;
+        image = create_synthetic_image(K4A_IMAGE_FORMAT_COLOR_MJPG, width, height, 0, size);
+        if (image == NULL)
+        {
+            return NULL;
+        }
+        uint8_t *buffer = k4a_image_get_buffer(image);
+        memset(buffer, (int)(m_frame_index & 0xff), size);
+        buffer[0] = 0xff;
+        buffer[1] = 0xd8;
+        buffer[size - 2] = 0xff;
+        buffer[size - 1] = 0xd9;
+        break;
+    }
+    case K4A_IMAGE_FORMAT_COLOR_NV12:
+    case K4A_IMAGE_FORMAT_COLOR_YUY2:
+    case K4A_IMAGE_FORMAT_COLOR_BGRA32:
+    {
+        int stride = m_device_config.color_format == K4A_IMAGE_FORMAT_COLOR_NV12 ?
+                         width :
+                         width * (m_device_config.color_format == K4A_IMAGE_FORMAT_COLOR_YUY2 ? 2 : 4);
+        size_t size = (size_t)stride * height;
+        if (m_device_config.color_format == K4A_IMAGE_FORMAT_COLOR_NV12)
+        {
+            size = size * 3 / 2;
+        }
+        image = create_synthetic_image(m_device_config.color_format, width, height, stride, size);
+        if (image == NULL)
+        {
+            return NULL;
+        }
+        memset(k4a_image_get_buffer(image), 128, k4a_image_get_size(image));
+        break;
+    }
+    default:
+        return NULL;
+    }
+
+    k4a_image_set_device_timestamp_usec(image, device_timestamp_usec);
+    k4a_image_set_system_timestamp_nsec(
+        image,
+        (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+    k4a_image_set_exposure_usec(image, 8330);
+    k4a_image_set_white_balance(image, 4500);
+    k4a_image_set_iso_speed(image, 400);
+    return image;
+}
+
+k4a_wait_result_t synthetic_capture_source::get_capture(k4a_capture_t *capture, int32_t timeout_ms)
+{
+    if (!m_cameras_started)
+    {
+        return K4A_WAIT_RESULT_FAILED;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    // Like a device, drop frames the caller was too slow to collect.
+    uint64_t current_frame = (uint64_t)((now - m_start_time) / m_frame_period);
+    if (current_frame > m_frame_index + 1)
+    {
+        m_frame_index = current_frame;
+    }
+
+    auto due = m_start_time + m_frame_period * m_frame_index;
+    if (due > now)
+    {
+        if (timeout_ms >= 0 && due - now > std::chrono::milliseconds(timeout_ms))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+            return K4A_WAIT_RESULT_TIMEOUT;
+        }
+        std::this_thread::sleep_until(due);
+    }
+
+    uint64_t device_timestamp_usec = syntheticTimestampOffsetUsec +
+                                     m_frame_index * (uint64_t)m_frame_period.count();
+    if (K4A_FAILED(k4a_capture_create(capture)))
+    {
+        return K4A_WAIT_RESULT_FAILED;
+    }
+    if (m_device_config.depth_mode != K4A_DEPTH_MODE_OFF)
+    {
+        k4a_image_t ir = create_depth_image(K4A_IMAGE_FORMAT_IR16, device_timestamp_usec);
+        if (ir != NULL)
+        {
+            k4a_capture_set_ir_image(*capture, ir);
+            k4a_image_release(ir);
+        }
+        if (m_device_config.depth_mode != K4A_DEPTH_MODE_PASSIVE_IR)
+        {
+            k4a_image_t depth = create_depth_image(K4A_IMAGE_FORMAT_DEPTH16, device_timestamp_usec);
+            if (depth != NULL)
+            {
+                k4a_capture_set_depth_image(*capture, depth);
+                k4a_image_release(depth);
+            }
+        }
+    }
+    if (m_device_config.color_resolution != K4A_COLOR_RESOLUTION_OFF)
+    {
+        k4a_image_t color = create_color_image(device_timestamp_usec +
+                                               (uint64_t)m_device_config.depth_delay_off_color_usec);
+        if (color != NULL)
+        {
+            k4a_capture_set_color_image(*capture, color);
+            k4a_image_release(color);
+        }
+    }
+    k4a_capture_set_temperature_c(*capture, 30.0f);
+
+    m_frame_index++;
+    return K4A_WAIT_RESULT_SUCCEEDED;
+}
+
+k4a_wait_result_t synthetic_capture_source::get_imu_sample(k4a_imu_sample_t *sample, int32_t timeout_ms)
+{
+    if (!m_imu_started)
+    {
+        return K4A_WAIT_RESULT_FAILED;
+    }
+
+    auto due = m_start_time + std::chrono::microseconds(m_imu_index * syntheticImuPeriodUsec);
+    auto now = std::chrono::steady_clock::now();
+    if (due > now)
+    {
+        if (timeout_ms >= 0 && due - now > std::chrono::milliseconds(timeout_ms))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+            return K4A_WAIT_RESULT_TIMEOUT;
+        }
+        std::this_thread::sleep_until(due);
+    }
+
+    uint64_t timestamp_usec = syntheticTimestampOffsetUsec + m_imu_index * syntheticImuPeriodUsec;
+    memset(sample, 0, sizeof(*sample));
+    sample->temperature = 30.0f;
+    sample->acc_sample.xyz.z = -9.81f;
+    sample->acc_timestamp_usec = timestamp_usec;
+    sample->gyro_timestamp_usec = timestamp_usec;
+    m_imu_index++;
+    return K4A_WAIT_RESULT_SUCCEEDED;
+}
+
+static bool parse_fault_probability(const std::string &value, double *probability)
+{
+    char *end = NULL;
+    *probability = strtod(value.c_str(), &end);
+    return end != value.c_str() && *end == '\0' && *probability >= 0.0 && *probability <= 1.0;
+}
+
+static bool parse_fault_uint(const std::string &value, uint32_t max, uint32_t *result)
+{
+    char *end = NULL;
+    unsigned long parsed = strtoul(value.c_str(), &end, 10);
+    if (end == value.c_str() || *end != '\0' || value[0] == '-' || parsed > max)
+    {
+        return false;
+    }
+    *result = (uint32_t)parsed;
+    return true;
+}
+
+bool parse_fault_injection(const char *str, fault_injection_t *faults)
+{
+    memset(faults, 0, sizeof(*faults));
+    faults->enabled = true;
+    faults->slow_write_ms = 200;
+    if (strcmp(str, "none") == 0)
+    {
+        return true;
+    }
+
+    std::istringstream items(str);
+    std::string item;
+    while (std::getline(items, item, ','))
+    {
+        size_t equals = item.find('=');
+        if (equals == std::string::npos)
+        {
+            return false;
+        }
+        std::string key = item.substr(0, equals);
+        std::string value = item.substr(equals + 1);
+        bool ok;
+        if (key == "seed")
+        {
+            ok = parse_fault_uint(value, UINT32_MAX, &faults->seed);
+        }
+        else if (key == "slow_write")
+        {
+            ok = parse_fault_probability(value, &faults->slow_write);
+        }
+        else if (key == "slow_write_ms")
+        {
+            ok = parse_fault_uint(value, 60000, &faults->slow_write_ms);
+        }
+        else if (key == "wait_failed")
+        {
+            ok = parse_fault_probability(value, &faults->wait_failed);
+        }
+        else if (key == "timestamp_jump")
+        {
+            ok = parse_fault_probability(value, &faults->timestamp_jump);
+        }
+        else if (key == "imu_reorder")
+        {
+            ok = parse_fault_probability(value, &faults->imu_reorder);
+        }
+        else if (key == "stop_stall_ms")
+        {
+            ok = parse_fault_uint(value, 600000, &faults->stop_stall_ms);
+        }
+        else
+        {
+            ok = false;
+        }
+        if (!ok)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string format_fault_injection(const fault_injection_t *faults)
+{
+    std::ostringstream str;
+    str << "seed=" << faults->seed;
+    if (faults->slow_write > 0)
+    {
+        str << ",slow_write=" << faults->slow_write << ",slow_write_ms=" << faults->slow_write_ms;
+    }
+    if (faults->wait_failed > 0)
+    {
+        str << ",wait_failed=" << faults->wait_failed;
+    }
+    if (faults->timestamp_jump > 0)
+    {
+        str << ",timestamp_jump=" << faults->timestamp_jump;
+    }
+    if (faults->imu_reorder > 0)
+    {
+        str << ",imu_reorder=" << faults->imu_reorder;
+    }
+    if (faults->stop_stall_ms > 0)
+    {
+        str << ",stop_stall_ms=" << faults->stop_stall_ms;
+    }
+    return str.str();
+}
+
+faulty_capture_source::faulty_capture_source(capture_source *source, const fault_injection_t *faults) :
+    m_source(source),
+    m_faults(*faults),
+    m_active(false),
+    m_random(faults->seed),
+    m_timestamp_offset_usec(0),
+    m_held_imu_valid(false),
+    m_held_imu_due(false)
+{
+    memset(&m_held_imu, 0, sizeof(m_held_imu));
+    memset(&m_counts, 0, sizeof(m_counts));
+}
+
+faulty_capture_source::~faulty_capture_source()
+{
+    delete m_source;
+}
+
+bool faulty_capture_source::roll(double probability)
+{
+    return m_active && probability > 0 && std::uniform_real_distribution<double>(0.0, 1.0)(m_random) < probability;
+}
+
+k4a_device_t faulty_capture_source::device() const
+{
+    return m_source->device();
+}
+
+k4a_result_t faulty_capture_source::start_cameras(const k4a_device_configuration_t *device_config)
+{
+    return m_source->start_cameras(device_config);
+}
+
+void faulty_capture_source::stop_cameras()
+{
+    if (m_faults.stop_stall_ms > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(m_faults.stop_stall_ms));
+    }
+    m_source->stop_cameras();
+}
+
+k4a_result_t faulty_capture_source::start_imu()
+{
+    return m_source->start_imu();
+}
+
+void faulty_capture_source::stop_imu()
+{
+    m_source->stop_imu();
+}
+
+k4a_wait_result_t faulty_capture_source::get_capture(k4a_capture_t *capture, int32_t timeout_ms)
+{
+    k4a_wait_result_t result = m_source->get_capture(capture, timeout_ms);
+    if (result != K4A_WAIT_RESULT_SUCCEEDED)
+    {
+        return result;
+    }
+    if (roll(m_faults.wait_failed))
+    {
+        m_counts.wait_failures++;
+        k4a_capture_release(*capture);
+        *capture = NULL;
+        return K4A_WAIT_RESULT_FAILED;
+    }
+    if (roll(m_faults.timestamp_jump))
+    {
+        m_counts.timestamp_jumps++;
+        m_timestamp_offset_usec += std::uniform_int_distribution<uint64_t>(1000000, 10000000)(m_random);
+    }
+    if (m_timestamp_offset_usec > 0)
+    {
+        k4a_image_t images[3] = { k4a_capture_get_color_image(*capture),
+                                  k4a_capture_get_depth_image(*capture),
+                                  k4a_capture_get_ir_image(*capture) };
+        for (k4a_image_t image : images)
+        {
+            if (image != NULL)
+            {
+                k4a_image_set_device_timestamp_usec(image,
+                                                    k4a_image_get_device_timestamp_usec(image) +
+                                                        m_timestamp_offset_usec);
+                k4a_image_release(image);
+            }
+        }
+    }
+    return result;
+}
+
+k4a_wait_result_t faulty_capture_source::get_imu_sample(k4a_imu_sample_t *sample, int32_t timeout_ms)
+{
+    if (m_held_imu_valid && m_held_imu_due)
+    {
+        *sample = m_held_imu;
+        m_held_imu_valid = false;
+        return K4A_WAIT_RESULT_SUCCEEDED;
+    }
+
+    k4a_wait_result_t result = m_source->get_imu_sample(sample, timeout_ms);
+    if (result != K4A_WAIT_RESULT_SUCCEEDED)
+    {
+        return result;
+    }
+    sample->acc_timestamp_usec += m_timestamp_offset_usec;
+    sample->gyro_timestamp_usec += m_timestamp_offset_usec;
+    if (m_held_imu_valid)
+    {
+        // The newer sample goes out first, the held one on the next call.
+        m_held_imu_due = true;
+    }
+    else if (roll(m_faults.imu_reorder))
+    {
+        m_counts.imu_reorders++;
+        m_held_imu = *sample;
+        m_held_imu_valid = true;
+        m_held_imu_due = false;
+        return K4A_WAIT_RESULT_TIMEOUT;
+    }
+    return result;
+}
+
+void faulty_capture_source::before_write()
+{
+    if (roll(m_faults.slow_write))
+    {
+        m_counts.slow_writes++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(m_faults.slow_write_ms));
+    }
+}
@@ -0,0 +1,163 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef CAPTURE_SOURCE_H
+#define CAPTURE_SOURCE_H
+
+#include <k4a/k4a.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+
+// Where the recorder gets its captures and IMU samples from: a real device, or a synthetic generator that lets the
+// whole pipeline (and a rig of recorder processes) run on a machine without cameras.
+class capture_source
+{
+public:
+    virtual ~capture_source() {}
+
+    // The underlying device, or NULL for sources without one.
+    virtual k4a_device_t device() const = 0;
+
+    virtual k4a_result_t start_cameras(const k4a_device_configuration_t *device_config) = 0;
+    virtual void stop_cameras() = 0;
+    virtual k4a_result_t start_imu() = 0;
+    virtual void stop_imu() = 0;
+
+    virtual k4a_wait_result_t get_capture(k4a_capture_t *capture, int32_t timeout_ms) = 0;
+    virtual k4a_wait_result_t get_imu_sample(k4a_imu_sample_t *sample, int32_t timeout_ms) = 0;
+};
+
+// Forwards to an open k4a device and closes it when destroyed.
+class device_capture_source : public capture_source
+{
+public:
+    explicit device_capture_source(k4a_device_t device);
+    ~device_capture_source() override;
+
+    k4a_device_t device() const override;
+    k4a_result_t start_cameras(const k4a_device_configuration_t *device_config) override;
+    void stop_cameras() override;
+    k4a_result_t start_imu() override;
+    void stop_imu() override;
+    k4a_wait_result_t get_capture(k4a_capture_t *capture, int32_t timeout_ms) override;
+    k4a_wait_result_t get_imu_sample(k4a_imu_sample_t *sample, int32_t timeout_ms) override;
+
+private:
+    k4a_device_t m_device;
+};
+
+// Generates captures in the configured modes at the configured frame rate: a static depth background with a moving
+// object, a matching IR image and a color image, with device and system timestamps. IMU samples run at 200 Hz.
+class synthetic_capture_source : public capture_source
+{
+public:
+    synthetic_capture_source();
+
+    k4a_device_t device() const override;
+    k4a_result_t start_cameras(const k4a_device_configuration_t *device_config) override;
+    void stop_cameras() override;
+    k4a_result_t start_imu() override;
+    void stop_imu() override;
+    k4a_wait_result_t get_capture(k4a_capture_t *capture, int32_t timeout_ms) override;
+    k4a_wait_result_t get_imu_sample(k4a_imu_sample_t *sample, int32_t timeout_ms) override;
+
+    // Images created by synthetic sources and not yet released by every holder, in this process. Captures that are
+    // never released keep their images, so a count above zero after the cameras stopped means a leak.
+    static int64_t live_images();
+
+private:
+    k4a_image_t create_depth_image(k4a_image_format_t format, uint64_t device_timestamp_usec);
+    k4a_image_t create_color_image(uint64_t device_timestamp_usec);
+
+    k4a_device_configuration_t m_device_config;
+    bool m_cameras_started;
+    bool m_imu_started;
+    uint64_t m_frame_index;
+    uint64_t m_imu_index;
+    std::chrono::microseconds m_frame_period;
+    std::chrono::steady_clock::time_point m_start_time;
+};
+
+// Faults injected into a synthetic source, for soak runs (see soak.h). Probabilities are per capture or IMU sample.
+typedef struct
+{
+    // Set by parse_fault_injection(). The recorder then also prints a soak report line when it exits.
+    bool enabled;
+    uint32_t seed;
+    // Stall the recording loop for slow_write_ms before the capture is written, like a disk that stops accepting
+    // data for a while.
+    double slow_write;
+    uint32_t slow_write_ms;
+    // Fail k4a_device_get_capture() with K4A_WAIT_RESULT_FAILED, which ends the take.
+    double wait_failed;
+    // Move device timestamps of all later captures and IMU samples forward by 1-10 s.
+    double timestamp_jump;
+    // Swap an IMU sample with the next one.
+    double imu_reorder;
+    // Hang for this long when the cameras are stopped, to exercise a second Ctrl-C.
+    uint32_t stop_stall_ms;
+} fault_injection_t;
+
+// Parses comma separated key=value pairs: seed, slow_write, slow_write_ms, wait_failed, timestamp_jump,
+// imu_reorder and stop_stall_ms, for example "slow_write=0.01,slow_write_ms=300,seed=7", or "none". Returns false
+// for unknown keys or values out of range.
+bool parse_fault_injection(const char *str, fault_injection_t *faults);
+std::string format_fault_injection(const fault_injection_t *faults);
+
+// How often each fault fired.
+typedef struct
+{
+    uint64_t slow_writes;
+    uint64_t wait_failures;
+    uint64_t timestamp_jumps;
+    uint64_t imu_reorders;
+} fault_counts_t;
+
+// Wraps another source and injects the configured faults into its captures and IMU samples.
+class faulty_capture_source : public capture_source
+{
+public:
+    // Takes ownership of source.
+    faulty_capture_source(capture_source *source, const fault_injection_t *faults);
+    ~faulty_capture_source() override;
+
+    k4a_device_t device() const override;
+    k4a_result_t start_cameras(const k4a_device_configuration_t *device_config) override;
+    void stop_cameras() override;
+    k4a_result_t start_imu() override;
+    void stop_imu() override;
+    k4a_wait_result_t get_capture(k4a_capture_t *capture, int32_t timeout_ms) override;
+    k4a_wait_result_t get_imu_sample(k4a_imu_sample_t *sample, int32_t timeout_ms) override;
+
+    // Called by the recorder right before a capture is written; may stall.
+    void before_write();
+
+    // Random faults are only injected while active, which the recorder sets for the take loop. A fault during the
+    // first-capture wait would end the run before there is anything to measure. stop_stall_ms applies regardless.
+    void set_active(bool active)
+    {
+        m_active = active;
+    }
+
+    const fault_counts_t *counts() const
+    {
+        return &m_counts;
+    }
+
+private:
+    bool roll(double probability);
+
+    capture_source *m_source;
+    fault_injection_t m_faults;
+    bool m_active;
+    std::mt19937 m_random;
+    uint64_t m_timestamp_offset_usec;
+    bool m_held_imu_valid;
+    bool m_held_imu_due;
+    k4a_imu_sample_t m_held_imu;
+    fault_counts_t m_counts;
+};
+
+#endif /* CAPTURE_SOURCE_H */
@@ -0,0 +1,514 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "capture_writer.h"
+#include "recorder.h"
+
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+static const char *depthRoiTrack = "DEPTH_ROI";
+static const char *irRoiTrack = "IR_ROI";
+static const char *colorRoiTrack = "COLOR_ROI";
+static const char *irHalfTrack = "IR_HALF";
+static const char *ir8BitTrack = "IR_8BIT";
+
+// BITMAPINFOHEADER, the codec private data of a "V_MS/VFW/FOURCC" Matroska track.
+#pragma pack(push, 1)
+typedef struct
+{
+    uint32_t biSize;
+    uint32_t biWidth;
+    uint32_t biHeight;
+    uint16_t biPlanes;
+    uint16_t biBitCount;
+    uint32_t biCompression;
+    uint32_t biSizeImage;
+    uint32_t biXPelsPerMeter;
+    uint32_t biYPelsPerMeter;
+    uint32_t biClrUsed;
+    uint32_t biClrImportant;
+} bitmap_info_header_t;
+#pragma pack(pop)
+
+static uint32_t make_fourcc(char a, char b, char c, char d)
+{
+    return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24);
+}
+
+static std::string format_rect(const roi_rect_t *rect)
+{
+    std::ostringstream str;
+    str << rect->x << "," << rect->y << "," << rect->width << "," << rect->height;
+    return str.str();
+}
+
+capture_writer::capture_writer(k4a_record_t recording, const k4a_device_configuration_t *device_config) :
+    m_recording(recording),
+    m_device_config(*device_config),
+    m_ir_mode(IR_MODE_FULL),
+    m_bytes_in(0),
+    m_bytes_out(0)
+{
+    memset(&m_depth, 0, sizeof(m_depth));
+    memset(&m_color, 0, sizeof(m_color));
+}
+
+k4a_result_t capture_writer::set_roi(const roi_settings_t *roi, const k4a_calibration_t *calibration)
+{
+    int width, height;
+    if (get_depth_mode_size(m_device_config.depth_mode, &width, &height))
+    {
+        m_depth.cropped = roi->depth_enabled;
+        m_depth.rect = roi->depth;
+        if (!m_depth.cropped && roi->stage_box_enabled)
+        {
+            if (calibration == NULL || K4A_FAILED(roi_from_stage_box(calibration,
+                                                                     &roi->stage_min_mm,
+                                                                     &roi->stage_max_mm,
+                                                                     K4A_CALIBRATION_TYPE_DEPTH,
+                                                                     &m_depth.rect)))
+            {
+                std::cerr << "Stage box is not in the depth camera view, recording full depth frames."
+                          << std::endl;
+            }
+            else
+            {
+                m_depth.cropped = true;
+            }
+        }
+        if (m_depth.cropped && !roi_clamp(&m_depth.rect, width, height, 1))
+        {
+            std::cerr << "Depth ROI is outside of the " << width << "x" << height << " depth image." << std::endl;
+            return K4A_RESULT_FAILED;
+        }
+    }
+
+    if (get_color_resolution_size(m_device_config.color_resolution, &width, &height))
+    {
+        m_color.cropped = roi->color_enabled;
+        m_color.rect = roi->color;
+        if (!m_color.cropped && roi->stage_box_enabled)
+        {
+            if (calibration == NULL || K4A_FAILED(roi_from_stage_box(calibration,
+                                                                     &roi->stage_min_mm,
+                                                                     &roi->stage_max_mm,
+                                                                     K4A_CALIBRATION_TYPE_COLOR,
+                                                                     &m_color.rect)))
+            {
+                std::cerr << "Stage box is not in the color camera view, recording full color frames."
+                          << std::endl;
+            }
+            else
+            {
+                m_color.cropped = true;
+            }
+        }
+        if (m_color.cropped && !roi_supports_format(m_device_config.color_format))
+        {
+            std::cerr << "Color ROI is not supported for this color format";
+            if (m_device_config.color_format == K4A_IMAGE_FORMAT_COLOR_MJPG)
+            {
+                std::cerr << " (MJPG cropping requires a build with K4ARECORDER_USE_TURBOJPEG)";
+            }
+            std::cerr << ", recording full color frames." << std::endl;
+            m_color.cropped = false;
+        }
+        if (m_color.cropped &&
+            !roi_clamp(&m_color.rect, width, height, roi_alignment_for_format(m_device_config.color_format)))
+        {
+            std::cerr << "Color ROI is outside of the " << width << "x" << height << " color image." << std::endl;
+            return K4A_RESULT_FAILED;
+        }
+    }
+
+    if (m_depth.cropped)
+    {
+        std::cout << "Depth ROI: " << format_rect(&m_depth.rect) << std::endl;
+    }
+    if (m_color.cropped)
+    {
+        std::cout << "Color ROI: " << format_rect(&m_color.rect) << std::endl;
+    }
+    return K4A_RESULT_SUCCEEDED;
+}
+
+k4a_result_t capture_writer::add_cropped_track(const char *track_name,
+                                               k4a_image_format_t format,
+                                               const roi_rect_t *rect)
+{
+    k4a_record_video_settings_t settings;
+    settings.width = (uint64_t)rect->width;
+    settings.height = (uint64_t)rect->height;
+    settings.frame_rate = k4a_convert_fps_to_uint(m_device_config.camera_fps);
+
+    if (format == K4A_IMAGE_FORMAT_COLOR_MJPG)
+    {
+        return k4a_record_add_custom_video_track(m_recording, track_name, "V_MJPEG", NULL, 0, &settings);
+    }
+
+    bitmap_info_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.biSize = sizeof(header);
+    header.biWidth = (uint32_t)rect->width;
+    header.biHeight = (uint32_t)rect->height;
+    header.biPlanes = 1;
+    switch (format)
+    {
+    case K4A_IMAGE_FORMAT_DEPTH16:
+    case K4A_IMAGE_FORMAT_IR16:
+        header.biBitCount = 16;
+        header.biCompression = make_fourcc('b', '1', '6', 'g');
+        break;
+    case K4A_IMAGE_FORMAT_CUSTOM8:
+        header.biBitCount = 8;
+        header.biCompression = make_fourcc('Y', '8', '0', '0');
+        break;
+    case K4A_IMAGE_FORMAT_COLOR_NV12:
+        header.biBitCount = 12;
+        header.biCompression = make_fourcc('N', 'V', '1', '2');
+        break;
+    case K4A_IMAGE_FORMAT_COLOR_YUY2:
+        header.biBitCount = 16;
+        header.biCompression = make_fourcc('Y', 'U', 'Y', '2');
+        break;
+    case K4A_IMAGE_FORMAT_COLOR_BGRA32:
+        header.biBitCount = 32;
+        header.biCompression = 0; // BI_RGB
+        break;
+    default:
+        return K4A_RESULT_FAILED;
+    }
+    header.biSizeImage = header.biWidth * header.biHeight * header.biBitCount / 8;
+
+    return k4a_record_add_custom_video_track(
+        m_recording, track_name, "V_MS/VFW/FOURCC", (const uint8_t *)&header, sizeof(header), &settings);
+}
+
+void capture_writer::set_depth_delta(uint32_t keyframe_interval, uint16_t threshold)
+{
+    int width, height;
+    if (m_device_config.depth_mode == K4A_DEPTH_MODE_PASSIVE_IR ||
+        !get_depth_mode_size(m_device_config.depth_mode, &width, &height))
+    {
+        return;
+    }
+    if (m_depth.cropped)
+    {
+        width = m_depth.rect.width;
+        height = m_depth.rect.height;
+    }
+    m_depth_delta.reset(new depth_delta_encoder((uint32_t)width, (uint32_t)height, keyframe_interval, threshold));
+}
+
+void capture_writer::set_ir_mode(ir_mode_t mode)
+{
+    int width, height;
+    if (!get_depth_mode_size(m_device_config.depth_mode, &width, &height))
+    {
+        return;
+    }
+    m_ir_mode = mode;
+}
+
+k4a_result_t capture_writer::add_tracks()
+{
+    if (m_ir_mode != IR_MODE_FULL)
+    {
+        roi_rect_t rect = m_depth.rect;
+        if (!m_depth.cropped)
+        {
+            rect.x = rect.y = 0;
+            get_depth_mode_size(m_device_config.depth_mode, &rect.width, &rect.height);
+        }
+        std::string tag = ir_mode_name(m_ir_mode);
+        k4a_result_t result = K4A_RESULT_SUCCEEDED;
+        if (m_ir_mode == IR_MODE_HALF)
+        {
+            rect.width /= 2;
+            rect.height /= 2;
+            result = add_cropped_track(irHalfTrack, K4A_IMAGE_FORMAT_IR16, &rect);
+        }
+        else if (m_ir_mode == IR_MODE_COMPRESSED)
+        {
+            tag += " sqrt max=" + std::to_string(irToneMapMax);
+            result = add_cropped_track(ir8BitTrack, K4A_IMAGE_FORMAT_CUSTOM8, &rect);
+        }
+        if (K4A_FAILED(result) || K4A_FAILED(k4a_record_add_tag(m_recording, "K4A_RECORDER_IR", tag.c_str())))
+        {
+            return K4A_RESULT_FAILED;
+        }
+    }
+
+    if (m_depth_delta)
+    {
+        k4a_record_subtitle_settings_t settings;
+        settings.high_freq_data = false;
+        const depth_delta_track_header_t *header = m_depth_delta->track_header();
+        std::ostringstream tag;
+        tag << "keyframe_interval=" << header->keyframe_interval << " threshold=" << header->threshold;
+        if (K4A_FAILED(k4a_record_add_custom_subtitle_track(m_recording,
+                                                            depthDeltaTrack,
+                                                            depthDeltaCodec,
+                                                            (const uint8_t *)header,
+                                                            sizeof(*header),
+                                                            &settings)) ||
+            K4A_FAILED(k4a_record_add_tag(m_recording, "K4A_RECORDER_DEPTH_DELTA", tag.str().c_str())))
+        {
+            return K4A_RESULT_FAILED;
+        }
+    }
+    if (m_depth.cropped)
+    {
+        if (m_device_config.depth_mode != K4A_DEPTH_MODE_PASSIVE_IR && !m_depth_delta)
+        {
+            if (K4A_FAILED(add_cropped_track(depthRoiTrack, K4A_IMAGE_FORMAT_DEPTH16, &m_depth.rect)))
+            {
+                return K4A_RESULT_FAILED;
+            }
+        }
+        if (m_ir_mode == IR_MODE_FULL)
+        {
+            if (K4A_FAILED(add_cropped_track(irRoiTrack, K4A_IMAGE_FORMAT_IR16, &m_depth.rect)))
+            {
+                return K4A_RESULT_FAILED;
+            }
+        }
+        if (K4A_FAILED(k4a_record_add_tag(m_recording, "K4A_RECORDER_DEPTH_ROI", format_rect(&m_depth.rect).c_str())))
+        {
+            return K4A_RESULT_FAILED;
+        }
+    }
+    if (m_color.cropped)
+    {
+        if (K4A_FAILED(add_cropped_track(colorRoiTrack, m_device_config.color_format, &m_color.rect)) ||
+            K4A_FAILED(k4a_record_add_tag(m_recording, "K4A_RECORDER_COLOR_ROI", format_rect(&m_color.rect).c_str())))
+        {
+            return K4A_RESULT_FAILED;
+        }
+    }
+    return K4A_RESULT_SUCCEEDED;
+}
+
+k4a_result_t capture_writer::write_cropped(const char *track_name, k4a_image_t image, const roi_rect_t *rect)
+{
+    k4a_image_t cropped = roi_crop_image(image, rect);
+    if (cropped == NULL)
+    {
+        std::cerr << "Runtime error: unable to crop image for track " << track_name << std::endl;
+        return K4A_RESULT_FAILED;
+    }
+
+    size_t size = k4a_image_get_size(cropped);
+    k4a_result_t result = k4a_record_write_custom_track_data(m_recording,
+                                                             track_name,
+                                                             k4a_image_get_device_timestamp_usec(cropped),
+                                                             k4a_image_get_buffer(cropped),
+                                                             size);
+    k4a_image_release(cropped);
+    m_bytes_out += size;
+    return result;
+}
+
+k4a_result_t capture_writer::write_depth_delta(k4a_image_t image)
+{
+    k4a_image_t source = m_depth.cropped ? roi_crop_image(image, &m_depth.rect) : image;
+    if (source == NULL)
+    {
+        std::cerr << "Runtime error: unable to crop image for track " << depthDeltaTrack << std::endl;
+        return K4A_RESULT_FAILED;
+    }
+
+    const depth_delta_track_header_t *header = m_depth_delta->track_header();
+    const uint8_t *buffer = k4a_image_get_buffer(source);
+    size_t row_bytes = header->width * sizeof(uint16_t);
+    size_t stride = (size_t)k4a_image_get_stride_bytes(source);
+    k4a_result_t result = K4A_RESULT_SUCCEEDED;
+    if ((uint32_t)k4a_image_get_width_pixels(source) != header->width ||
+        (uint32_t)k4a_image_get_height_pixels(source) != header->height)
+    {
+        std::cerr << "Runtime error: depth image size does not match the " << depthDeltaTrack << " track" << std::endl;
+        result = K4A_RESULT_FAILED;
+    }
+    else
+    {
+        const uint16_t *pixels = (const uint16_t *)buffer;
+        if (stride != row_bytes)
+        {
+            m_delta_pixels.resize((size_t)header->width * header->height);
+            for (uint32_t y = 0; y < header->height; y++)
+            {
+                memcpy(&m_delta_pixels[(size_t)y * header->width], buffer + y * stride, row_bytes);
+            }
+            pixels = m_delta_pixels.data();
+        }
+        m_depth_delta->encode(pixels, &m_delta_block);
+        result = k4a_record_write_custom_track_data(m_recording,
+                                                    depthDeltaTrack,
+                                                    k4a_image_get_device_timestamp_usec(source),
+                                                    m_delta_block.data(),
+                                                    m_delta_block.size());
+        m_bytes_out += m_delta_block.size();
+    }
+
+    if (source != image)
+    {
+        k4a_image_release(source);
+    }
+    return result;
+}
+
+k4a_result_t capture_writer::write_ir(k4a_image_t image)
+{
+    if (m_ir_mode == IR_MODE_OFF)
+    {
+        return K4A_RESULT_SUCCEEDED;
+    }
+
+    k4a_image_t source = m_depth.cropped ? roi_crop_image(image, &m_depth.rect) : image;
+    if (source == NULL)
+    {
+        std::cerr << "Runtime error: unable to crop the IR image" << std::endl;
+        return K4A_RESULT_FAILED;
+    }
+
+    const uint16_t *pixels = (const uint16_t *)k4a_image_get_buffer(source);
+    int width = k4a_image_get_width_pixels(source);
+    int height = k4a_image_get_height_pixels(source);
+    size_t stride = (size_t)k4a_image_get_stride_bytes(source);
+    const char *track_name;
+    if (m_ir_mode == IR_MODE_HALF)
+    {
+        track_name = irHalfTrack;
+        m_ir_buffer.resize((size_t)(width / 2) * (height / 2) * sizeof(uint16_t));
+        ir_downsample_2x2(pixels, width, height, stride, (uint16_t *)m_ir_buffer.data());
+    }
+    else
+    {
+        track_name = ir8BitTrack;
+        m_ir_buffer.resize((size_t)width * height);
+        ir_tone_map_8bit(pixels, width, height, stride, m_ir_buffer.data());
+    }
+
+    k4a_result_t result = k4a_record_write_custom_track_data(m_recording,
+                                                             track_name,
+                                                             k4a_image_get_device_timestamp_usec(source),
+                                                             m_ir_buffer.data(),
+                                                             m_ir_buffer.size());
+    m_bytes_out += m_ir_buffer.size();
+    if (source != image)
+    {
+        k4a_image_release(source);
+    }
+    return result;
+}
+
+k4a_result_t capture_writer::write_capture(k4a_capture_t capture)
+{
+    k4a_image_t images[3] = { k4a_capture_get_color_image(capture),
+                              k4a_capture_get_depth_image(capture),
+                              k4a_capture_get_ir_image(capture) };
+    size_t capture_bytes = 0;
+    size_t passthrough_bytes = 0;
+    for (k4a_image_t image : images)
+    {
+        if (image != NULL)
+        {
+            capture_bytes += k4a_image_get_size(image);
+        }
+    }
+    m_bytes_in += capture_bytes;
+
+    k4a_result_t result = K4A_RESULT_SUCCEEDED;
+    if (!m_depth.cropped && !m_color.cropped && !m_depth_delta && m_ir_mode == IR_MODE_FULL)
+    {
+        m_bytes_out += capture_bytes;
+        result = k4a_record_write_capture(m_recording, capture);
+    }
+    else
+    {
+        k4a_capture_t passthrough = NULL;
+        result = k4a_capture_create(&passthrough);
+
+        if (K4A_SUCCEEDED(result) && images[0] != NULL)
+        {
+            if (m_color.cropped)
+            {
+                result = write_cropped(colorRoiTrack, images[0], &m_color.rect);
+            }
+            else
+            {
+                k4a_capture_set_color_image(passthrough, images[0]);
+                passthrough_bytes += k4a_image_get_size(images[0]);
+            }
+        }
+        if (K4A_SUCCEEDED(result) && images[1] != NULL)
+        {
+            if (m_depth_delta)
+            {
+                result = write_depth_delta(images[1]);
+            }
+            else if (m_depth.cropped)
+            {
+                result = write_cropped(depthRoiTrack, images[1], &m_depth.rect);
+            }
+            else
+            {
+                k4a_capture_set_depth_image(passthrough, images[1]);
+                passthrough_bytes += k4a_image_get_size(images[1]);
+            }
+        }
+        if (K4A_SUCCEEDED(result) && images[2] != NULL)
+        {
+            if (m_ir_mode != IR_MODE_FULL)
+            {
+                result = write_ir(images[2]);
+            }
+            else if (m_depth.cropped)
+            {
+                result = write_cropped(irRoiTrack, images[2], &m_depth.rect);
+            }
+            else
+            {
+                k4a_capture_set_ir_image(passthrough, images[2]);
+                passthrough_bytes += k4a_image_get_size(images[2]);
+            }
+        }
+
+        if (K4A_SUCCEEDED(result) && passthrough_bytes > 0)
+        {
+            result = k4a_record_write_capture(m_recording, passthrough);
+            m_bytes_out += passthrough_bytes;
+        }
+        if (passthrough != NULL)
+        {
+            k4a_capture_release(passthrough);
+        }
+    }
+
+    for (k4a_image_t image : images)
+    {
+        if (image != NULL)
+        {
+            k4a_image_release(image);
+        }
+    }
+    return result;
+}
+
+void capture_writer::print_summary() const
+{
+    if (!m_depth.cropped && !m_color.cropped && !m_depth_delta && m_ir_mode == IR_MODE_FULL)
+    {
+        return;
+    }
+    std::cout << "Wrote " << m_bytes_out / (1024 * 1024) << " MiB of " << m_bytes_in / (1024 * 1024)
+              << " MiB image data";
+    if (m_bytes_in > 0)
+    {
+        std::cout << " (" << (100 * m_bytes_out / m_bytes_in) << "%)";
+    }
+    std::cout << std::endl;
+}
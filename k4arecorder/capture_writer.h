@@ -0,0 +1,72 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef CAPTURE_WRITER_H
+#define CAPTURE_WRITER_H
+
+#include <k4a/k4a.h>
+#include <k4arecord/record.h>
+
+#include <memory>
+#include <vector>
+
+#include "depth_delta.h"
+#include "ir_transform.h"
+#include "roi.h"
+
+// Writes captures into a recording. Streams with a region of interest are cropped and written into custom tracks
+// ("DEPTH_ROI", "IR_ROI", "COLOR_ROI"). Depth can be delta coded into "DEPTH_DELTA" (see depth_delta.h), and IR
+// dropped, halved into "IR_HALF" or tone mapped into "IR_8BIT" (see ir_transform.h). Everything else goes through
+// k4a_record_write_capture() unchanged. The built-in track of a redirected stream stays declared but receives no
+// blocks, so the file keeps the layout standard playback expects.
+class capture_writer
+{
+public:
+    capture_writer(k4a_record_t recording, const k4a_device_configuration_t *device_config);
+
+    // Resolves the ROI settings against the camera modes. The calibration is only needed for a stage box and may be
+    // NULL otherwise. Must be called before add_tracks().
+    k4a_result_t set_roi(const roi_settings_t *roi, const k4a_calibration_t *calibration);
+
+    // Writes depth (after any ROI crop) delta coded to the DEPTH_DELTA track. Must be called after set_roi() and
+    // before add_tracks(); ignored in modes without depth.
+    void set_depth_delta(uint32_t keyframe_interval, uint16_t threshold);
+
+    // Records IR as configured instead of at full resolution. Must be called after set_roi() and before
+    // add_tracks().
+    void set_ir_mode(ir_mode_t mode);
+
+    // Adds the custom tracks and tags. Must be called before k4a_record_write_header().
+    k4a_result_t add_tracks();
+
+    k4a_result_t write_capture(k4a_capture_t capture);
+
+    // Prints how many image bytes were written compared to what the cameras delivered.
+    void print_summary() const;
+
+private:
+    struct stream_route_t
+    {
+        bool cropped;
+        roi_rect_t rect;
+    };
+
+    k4a_result_t add_cropped_track(const char *track_name, k4a_image_format_t format, const roi_rect_t *rect);
+    k4a_result_t write_cropped(const char *track_name, k4a_image_t image, const roi_rect_t *rect);
+    k4a_result_t write_depth_delta(k4a_image_t image);
+    k4a_result_t write_ir(k4a_image_t image);
+
+    k4a_record_t m_recording;
+    k4a_device_configuration_t m_device_config;
+    stream_route_t m_depth;
+    stream_route_t m_color;
+    std::unique_ptr<depth_delta_encoder> m_depth_delta;
+    std::vector<uint8_t> m_delta_block;
+    std::vector<uint16_t> m_delta_pixels;
+    ir_mode_t m_ir_mode;
+    std::vector<uint8_t> m_ir_buffer;
+    uint64_t m_bytes_in;
+    uint64_t m_bytes_out;
+};
+
+#endif /* CAPTURE_WRITER_H */
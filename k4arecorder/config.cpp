@@ -0,0 +1,539 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "config.h"
+
+#include <cassert>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+int string_compare(const char *s1, const char *s2)
+{
+    assert(s1 != NULL);
+    assert(s2 != NULL);
+
+    while (tolower((unsigned char)*s1) == tolower((unsigned char)*s2))
+    {
+        if (*s1 == '\0')
+        {
+            return 0;
+        }
+        s1++;
+        s2++;
+    }
+    // The return value shows the relations between s1 and s2.
+    // Return value   Description
+    //     < 0        s1 less than s2
+    //       0        s1 identical to s2
+    //     > 0        s1 greater than s2
+    return (int)tolower((unsigned char)*s1) - (int)tolower((unsigned char)*s2);
+}
+
+void init_recorder_config(recorder_config_t *config)
+{
+    config->device_index = 0;
+    config->recording_length = -1;
+    config->device_config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
+    config->device_config.color_format = K4A_IMAGE_FORMAT_COLOR_MJPG;
+    config->device_config.color_resolution = K4A_COLOR_RESOLUTION_1080P;
+    config->device_config.depth_mode = K4A_DEPTH_MODE_NFOV_UNBINNED;
+    config->device_config.camera_fps = K4A_FRAMES_PER_SECOND_30;
+    config->device_config.wired_sync_mode = K4A_WIRED_SYNC_MODE_STANDALONE;
+    config->recording_rate_set = false;
+    config->record_imu = false;
+    config->color_controls.absoluteExposureValue = defaultExposureAuto;
+    config->color_controls.whitebalance = defaultWhitebalance;
+    config->color_controls.gain = defaultGainAuto;
+    config->color_controls.brightness = defaultBrightness;
+    config->color_controls.contrast = defaultContrast;
+    config->color_controls.saturation = defaultSaturation;
+    config->color_controls.sharpness = defaultSharpness;
+    config->roi = roi_settings_t();
+    config->frame_metadata = true;
+    config->depth_delta = false;
+    config->depth_delta_keyframe_interval = 30;
+    config->depth_delta_threshold = 4;
+    config->ir_mode = IR_MODE_FULL;
+    config->synthetic = false;
+    config->faults = fault_injection_t();
+    config->control_port = 0;
+    config->control_bind = "127.0.0.1";
+    config->output_dir = ".";
+    config->storage_check = STORAGE_CHECK_WARN;
+    config->min_free_mb = 256;
+}
+
+static int32_t parse_int(const std::string &value)
+{
+    size_t parsed = 0;
+    int result = std::stoi(value, &parsed);
+    if (parsed != value.size())
+    {
+        throw std::runtime_error("Expected an integer: " + value);
+    }
+    return result;
+}
+
+static int32_t parse_ranged_int(const std::string &value, int32_t min, int32_t max, const char *message)
+{
+    int32_t result = parse_int(value);
+    if (result < min || result > max)
+    {
+        throw std::runtime_error(message);
+    }
+    return result;
+}
+
+static void parse_color_mode(recorder_config_t *config, const char *value)
+{
+    k4a_device_configuration_t *device_config = &config->device_config;
+    if (string_compare(value, "2160p") == 0)
+    {
+        device_config->color_resolution = K4A_COLOR_RESOLUTION_2160P;
+    }
+    else if (string_compare(value, "1536p") == 0)
+    {
+        device_config->color_resolution = K4A_COLOR_RESOLUTION_1536P;
+    }
+    else if (string_compare(value, "1440p") == 0)
+    {
+        device_config->color_resolution = K4A_COLOR_RESOLUTION_1440P;
+    }
+    else if (string_compare(value, "1080p") == 0)
+    {
+        device_config->color_resolution = K4A_COLOR_RESOLUTION_1080P;
+    }
+    else if (string_compare(value, "720p") == 0)
+    {
+        device_config->color_resolution = K4A_COLOR_RESOLUTION_720P;
+    }
+    else if (string_compare(value, "720p_NV12") == 0)
+    {
+        device_config->color_format = K4A_IMAGE_FORMAT_COLOR_NV12;
+        device_config->color_resolution = K4A_COLOR_RESOLUTION_720P;
+    }
+    else if (string_compare(value, "720p_YUY2") == 0)
+    {
+        device_config->color_format = K4A_IMAGE_FORMAT_COLOR_YUY2;
+        device_config->color_resolution = K4A_COLOR_RESOLUTION_720P;
+    }
+    else if (string_compare(value, "off") == 0)
+    {
+        device_config->color_resolution = K4A_COLOR_RESOLUTION_OFF;
+    }
+    else
+    {
+        device_config->color_resolution = K4A_COLOR_RESOLUTION_OFF;
+
+        std::ostringstream str;
+        str << "Unknown color mode specified: " << value;
+        throw std::runtime_error(str.str());
+    }
+}
+
+static void parse_depth_mode(recorder_config_t *config, const char *value)
+{
+    k4a_device_configuration_t *device_config = &config->device_config;
+    if (string_compare(value, "NFOV_2X2BINNED") == 0)
+    {
+        device_config->depth_mode = K4A_DEPTH_MODE_NFOV_2X2BINNED;
+    }
+    else if (string_compare(value, "NFOV_UNBINNED") == 0)
+    {
+        device_config->depth_mode = K4A_DEPTH_MODE_NFOV_UNBINNED;
+    }
+    else if (string_compare(value, "WFOV_2X2BINNED") == 0)
+    {
+        device_config->depth_mode = K4A_DEPTH_MODE_WFOV_2X2BINNED;
+    }
+    else if (string_compare(value, "WFOV_UNBINNED") == 0)
+    {
+        device_config->depth_mode = K4A_DEPTH_MODE_WFOV_UNBINNED;
+    }
+    else if (string_compare(value, "PASSIVE_IR") == 0)
+    {
+        device_config->depth_mode = K4A_DEPTH_MODE_PASSIVE_IR;
+    }
+    else if (string_compare(value, "off") == 0)
+    {
+        device_config->depth_mode = K4A_DEPTH_MODE_OFF;
+    }
+    else
+    {
+        std::ostringstream str;
+        str << "Unknown depth mode specified: " << value;
+        throw std::runtime_error(str.str());
+    }
+}
+
+static void parse_rate(recorder_config_t *config, const char *value)
+{
+    k4a_device_configuration_t *device_config = &config->device_config;
+    config->recording_rate_set = true;
+    if (string_compare(value, "30") == 0)
+    {
+        device_config->camera_fps = K4A_FRAMES_PER_SECOND_30;
+    }
+    else if (string_compare(value, "25") == 0)
+    {
+        device_config->camera_fps = K4A_FRAMES_PER_SECOND_25;
+    }
+    else if (string_compare(value, "15") == 0)
+    {
+        device_config->camera_fps = K4A_FRAMES_PER_SECOND_15;
+    }
+    else if (string_compare(value, "5") == 0)
+    {
+        device_config->camera_fps = K4A_FRAMES_PER_SECOND_5;
+    }
+    else
+    {
+        std::ostringstream str;
+        str << "Unknown frame rate specified: " << value;
+        throw std::runtime_error(str.str());
+    }
+}
+
+static bool parse_on_off(const char *value, const char *name)
+{
+    if (string_compare(value, "on") == 0 || string_compare(value, "true") == 0)
+    {
+        return true;
+    }
+    else if (string_compare(value, "off") == 0 || string_compare(value, "false") == 0)
+    {
+        return false;
+    }
+    std::ostringstream str;
+    str << "Unknown " << name << " mode specified: " << value;
+    throw std::runtime_error(str.str());
+}
+
+static void parse_external_sync(recorder_config_t *config, const char *value)
+{
+    k4a_device_configuration_t *device_config = &config->device_config;
+    if (string_compare(value, "master") == 0)
+    {
+        device_config->wired_sync_mode = K4A_WIRED_SYNC_MODE_MASTER;
+    }
+    else if (string_compare(value, "subordinate") == 0 || string_compare(value, "sub") == 0)
+    {
+        device_config->wired_sync_mode = K4A_WIRED_SYNC_MODE_SUBORDINATE;
+    }
+    else if (string_compare(value, "standalone") == 0)
+    {
+        device_config->wired_sync_mode = K4A_WIRED_SYNC_MODE_STANDALONE;
+    }
+    else
+    {
+        std::ostringstream str;
+        str << "Unknown external sync mode specified: " << value;
+        throw std::runtime_error(str.str());
+    }
+}
+
+void set_config_value(recorder_config_t *config, const std::string &key, const std::string &value)
+{
+    color_control_settings_t *color = &config->color_controls;
+
+    if (key == "device.index")
+    {
+        config->device_index = (uint8_t)parse_ranged_int(value, 0, 255, "Device index must 0-255");
+    }
+    else if (key == "device.color_mode")
+    {
+        parse_color_mode(config, value.c_str());
+    }
+    else if (key == "device.depth_mode")
+    {
+        parse_depth_mode(config, value.c_str());
+    }
+    else if (key == "device.depth_delay")
+    {
+        config->device_config.depth_delay_off_color_usec = parse_int(value);
+    }
+    else if (key == "device.rate")
+    {
+        parse_rate(config, value.c_str());
+    }
+    else if (key == "device.imu")
+    {
+        config->record_imu = parse_on_off(value.c_str(), "imu");
+    }
+    else if (key == "device.external_sync")
+    {
+        parse_external_sync(config, value.c_str());
+    }
+    else if (key == "device.synthetic")
+    {
+        config->synthetic = parse_on_off(value.c_str(), "synthetic source");
+    }
+    else if (key == "device.inject_faults")
+    {
+        if (!parse_fault_injection(value.c_str(), &config->faults))
+        {
+            throw std::runtime_error("Invalid fault injection: " + value);
+        }
+    }
+    else if (key == "device.sync_delay")
+    {
+        int delay = parse_int(value);
+        if (delay < 0)
+        {
+            throw std::runtime_error("External sync delay must be positive.");
+        }
+        config->device_config.subordinate_delay_off_master_usec = (uint32_t)delay;
+    }
+    else if (key == "color.exposure")
+    {
+        color->absoluteExposureValue = parse_ranged_int(value, 100, 409500, "Exposure value range is 100 to 409500");
+    }
+    else if (key == "color.brightness")
+    {
+        color->brightness = parse_ranged_int(value, 0, 100, "Brightness value must be between 0 and 100.");
+    }
+    else if (key == "color.contrast")
+    {
+        color->contrast = parse_ranged_int(value, 0, 100, "Contrast value must be between 0 and 100.");
+    }
+    else if (key == "color.saturation")
+    {
+        color->saturation = parse_ranged_int(value, 0, 100, "Saturation value must be between 0 and 100.");
+    }
+    else if (key == "color.sharpness")
+    {
+        color->sharpness = parse_ranged_int(value, 0, 100, "Sharpness value must be between 0 and 100.");
+    }
+    else if (key == "color.whitebalance")
+    {
+        color->whitebalance = parse_ranged_int(value,
+                                               2000,
+                                               11000,
+                                               "White balance value must be between 2800 and 6500K.");
+    }
+    else if (key == "color.gain")
+    {
+        color->gain = parse_ranged_int(value, 1, 255, "Gain value must be between 0 and 255.");
+    }
+    else if (key == "pipeline.record_length")
+    {
+        config->recording_length = parse_int(value);
+        if (config->recording_length < 0)
+            throw std::runtime_error("Recording length must be positive");
+    }
+    else if (key == "pipeline.roi_depth")
+    {
+        if (!parse_roi_rect(value.c_str(), &config->roi.depth))
+        {
+            throw std::runtime_error("Depth ROI must be x,y,width,height");
+        }
+        config->roi.depth_enabled = true;
+    }
+    else if (key == "pipeline.roi_color")
+    {
+        if (!parse_roi_rect(value.c_str(), &config->roi.color))
+        {
+            throw std::runtime_error("Color ROI must be x,y,width,height");
+        }
+        config->roi.color_enabled = true;
+    }
+    else if (key == "pipeline.roi_stage")
+    {
+        if (!parse_stage_box(value.c_str(), &config->roi.stage_min_mm, &config->roi.stage_max_mm))
+        {
+            throw std::runtime_error("Stage box must be xmin,ymin,zmin,xmax,ymax,zmax with z > 0");
+        }
+        config->roi.stage_box_enabled = true;
+    }
+    else if (key == "pipeline.frame_metadata")
+    {
+        config->frame_metadata = parse_on_off(value.c_str(), "frame metadata");
+    }
+    else if (key == "pipeline.depth_delta")
+    {
+        config->depth_delta = parse_on_off(value.c_str(), "depth delta");
+    }
+    else if (key == "pipeline.depth_delta_keyframe")
+    {
+        config->depth_delta_keyframe_interval = (uint32_t)
+            parse_ranged_int(value, 1, 3600, "Depth delta keyframe interval must be 1-3600 frames");
+    }
+    else if (key == "pipeline.depth_delta_threshold")
+    {
+        config->depth_delta_threshold = (uint16_t)
+            parse_ranged_int(value, 0, 1000, "Depth delta threshold must be 0-1000 mm");
+    }
+    else if (key == "pipeline.ir")
+    {
+        if (!parse_ir_mode(value.c_str(), &config->ir_mode))
+        {
+            throw std::runtime_error("Unknown IR mode specified: " + value);
+        }
+    }
+    else if (key == "pipeline.storage_check")
+    {
+        if (string_compare(value.c_str(), "refuse") == 0)
+        {
+            config->storage_check = STORAGE_CHECK_REFUSE;
+        }
+        else if (string_compare(value.c_str(), "warn") == 0)
+        {
+            config->storage_check = STORAGE_CHECK_WARN;
+        }
+        else if (string_compare(value.c_str(), "off") == 0)
+        {
+            config->storage_check = STORAGE_CHECK_OFF;
+        }
+        else
+        {
+            throw std::runtime_error("Unknown storage check mode specified: " + value);
+        }
+    }
+    else if (key == "pipeline.min_free_mb")
+    {
+        config->min_free_mb = (uint32_t)parse_ranged_int(value, 1, 1048576, "Minimum free space must be 1-1048576 MB");
+    }
+    else if (key == "pipeline.control_port")
+    {
+        config->control_port = (uint16_t)parse_ranged_int(value, 1, 65535, "Control port must be 1-65535");
+    }
+    else if (key == "pipeline.control_bind")
+    {
+        config->control_bind = value;
+    }
+    else if (key == "pipeline.output_dir")
+    {
+        if (value.empty())
+        {
+            throw std::runtime_error("Output directory must not be empty");
+        }
+        config->output_dir = value;
+    }
+    else
+    {
+        throw std::runtime_error("Unknown setting: " + key);
+    }
+}
+
+static std::string trim(const std::string &str)
+{
+    size_t begin = str.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+    {
+        return std::string();
+    }
+    size_t end = str.find_last_not_of(" \t\r");
+    return str.substr(begin, end - begin + 1);
+}
+
+// Removes a trailing comment that is not part of a quoted string.
+static std::string strip_comment(const std::string &line)
+{
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); i++)
+    {
+        if (line[i] == '"')
+        {
+            quoted = !quoted;
+        }
+        else if (line[i] == '#' && !quoted)
+        {
+            return line.substr(0, i);
+        }
+    }
+    return line;
+}
+
+int load_config_file(const char *path, recorder_config_t *config)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "Unable to open config file: " << path << std::endl;
+        return 1;
+    }
+
+    std::string section;
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line))
+    {
+        line_number++;
+        line = trim(strip_comment(line));
+        if (line.empty())
+        {
+            continue;
+        }
+
+        try
+        {
+            if (line[0] == '[')
+            {
+                if (line[line.size() - 1] != ']')
+                {
+                    throw std::runtime_error("Malformed section header");
+                }
+                section = trim(line.substr(1, line.size() - 2));
+                continue;
+            }
+
+            size_t equals = line.find('=');
+            if (equals == std::string::npos)
+            {
+                throw std::runtime_error("Expected key = value");
+            }
+            std::string key = trim(line.substr(0, equals));
+            std::string value = trim(line.substr(equals + 1));
+            if (value.size() >= 2 && value[0] == '"' && value[value.size() - 1] == '"')
+            {
+                value = value.substr(1, value.size() - 2);
+            }
+            if (key.find('.') == std::string::npos)
+            {
+                key = section + "." + key;
+            }
+            set_config_value(config, key, value);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << path << ":" << line_number << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int validate_recorder_config(recorder_config_t *config)
+{
+    k4a_device_configuration_t *device_config = &config->device_config;
+    if (device_config->camera_fps == K4A_FRAMES_PER_SECOND_30 &&
+        (device_config->depth_mode == K4A_DEPTH_MODE_WFOV_UNBINNED ||
+         device_config->color_resolution == K4A_COLOR_RESOLUTION_3072P))
+    {
+        if (!config->recording_rate_set)
+        {
+            // Default to max supported frame rate
+            device_config->camera_fps = K4A_FRAMES_PER_SECOND_15;
+        }
+        else
+        {
+            std::cerr << "Error: 30 Frames per second is not supported by this camera mode." << std::endl;
+            return 1;
+        }
+    }
+    if (device_config->subordinate_delay_off_master_usec > 0 &&
+        device_config->wired_sync_mode != K4A_WIRED_SYNC_MODE_SUBORDINATE)
+    {
+        std::cerr << "--sync-delay is only valid if --external-sync is set to Subordinate." << std::endl;
+        return 1;
+    }
+    if (config->faults.enabled && !config->synthetic)
+    {
+        std::cerr << "--inject-faults is only valid with --synthetic." << std::endl;
+        return 1;
+    }
+    return 0;
+}
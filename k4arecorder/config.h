@@ -0,0 +1,36 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+
+#include "recorder.h"
+
+// Case-insensitive string comparison, returns 0 if equal.
+int string_compare(const char *s1, const char *s2);
+
+// Fills in the defaults that apply when neither the command line nor a config file sets a value.
+void init_recorder_config(recorder_config_t *config);
+
+// Applies one setting by its config file key, e.g. "device.depth_mode" or "color.exposure". Command line options
+// go through the same function so both share one set of names, defaults and range checks.
+// Throws std::runtime_error on unknown keys or invalid values.
+void set_config_value(recorder_config_t *config, const std::string &key, const std::string &value);
+
+// Loads a TOML-style config file:
+//
+//   [device]
+//   depth_mode = "NFOV_UNBINNED"
+//   [color]
+//   exposure = 8330
+//
+// Sections are "device", "color" and "pipeline"; the key names are listed in the README. Returns 0 on success,
+// otherwise prints the offending line and returns 1.
+int load_config_file(const char *path, recorder_config_t *config);
+
+// Checks combinations that cannot be validated per value and picks the default frame rate. Returns 0 on success.
+int validate_recorder_config(recorder_config_t *config);
+
+#endif /* CONFIG_H */
@@ -0,0 +1,169 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "control_server.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+int start_control_server(const char *bind_address,
+                         uint16_t port,
+                         std::shared_ptr<session_command_queue> queue)
+{
+    (void)bind_address; // Unused
+    (void)port;         // Unused
+    (void)queue;        // Unused
+    std::cerr << "The control server is not supported on Windows." << std::endl;
+    return 1;
+}
+
+#else
+
+// Closes the socket once the reader and every pending reply are done with it.
+class control_connection
+{
+public:
+    explicit control_connection(int fd) : m_fd(fd) {}
+    ~control_connection()
+    {
+        close(m_fd);
+    }
+
+    int fd() const
+    {
+        return m_fd;
+    }
+
+    void send_line(const std::string &line)
+    {
+        std::string data = line + "\n";
+        size_t sent = 0;
+        while (sent < data.size())
+        {
+            ssize_t result = send(m_fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (result < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (result <= 0)
+            {
+                return;
+            }
+            sent += (size_t)result;
+        }
+    }
+
+private:
+    int m_fd;
+};
+
+static void serve_connection(std::shared_ptr<control_connection> connection,
+                             std::shared_ptr<session_command_queue> queue)
+{
+    std::string pending;
+    char buffer[512];
+    for (;;)
+    {
+        ssize_t received = recv(connection->fd(), buffer, sizeof(buffer), 0);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            break;
+        }
+        pending.append(buffer, (size_t)received);
+
+        size_t newline;
+        while ((newline = pending.find('\n')) != std::string::npos)
+        {
+            std::string line = pending.substr(0, newline);
+            pending.erase(0, newline + 1);
+            if (!line.empty() && line[line.size() - 1] == '\r')
+            {
+                line.erase(line.size() - 1);
+            }
+            if (line.empty())
+            {
+                continue;
+            }
+
+            session_command_t command;
+            std::string error;
+            if (!parse_session_command(line, &command, &error))
+            {
+                connection->send_line("ERR " + error);
+                continue;
+            }
+            command.reply = [connection](const std::string &response) { connection->send_line(response); };
+            queue->push(command);
+        }
+    }
+}
+
+int start_control_server(const char *bind_address,
+                         uint16_t port,
+                         std::shared_ptr<session_command_queue> queue)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        std::cerr << "Runtime error: socket() failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, bind_address, &address.sin_addr) != 1)
+    {
+        std::cerr << "Invalid control bind address: " << bind_address << std::endl;
+        close(listener);
+        return 1;
+    }
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 16) != 0)
+    {
+        std::cerr << "Unable to listen on control port " << port << ": " << strerror(errno) << std::endl;
+        close(listener);
+        return 1;
+    }
+
+    std::thread([listener, queue]() {
+        for (;;)
+        {
+            int client = accept(listener, NULL, NULL);
+            if (client < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                {
+                    continue;
+                }
+                std::cerr << "Runtime error: accept() failed: " << strerror(errno) << std::endl;
+                break;
+            }
+            std::thread(serve_connection, std::make_shared<control_connection>(client), queue).detach();
+        }
+    }).detach();
+
+    std::cout << "Control server listening on " << bind_address << ":" << port << std::endl;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,19 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef CONTROL_SERVER_H
+#define CONTROL_SERVER_H
+
+#include <stdint.h>
+
+#include <memory>
+
+#include "session.h"
+
+// Accepts TCP connections on the given IPv4 address and port and feeds each received line into the command queue as
+// a session command (see parse_session_command). Every command gets exactly one response line, "OK ..." or "ERR ...".
+// The server runs on background threads for the lifetime of the process, sharing ownership of the queue. Returns 0
+// on success.
+int start_control_server(const char *bind_address, uint16_t port, std::shared_ptr<session_command_queue> queue);
+
+#endif /* CONTROL_SERVER_H */
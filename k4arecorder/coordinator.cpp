@@ -0,0 +1,462 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "coordinator.h"
+#include "config.h"
+
+#include <iostream>
+
+#if defined(_WIN32)
+
+int run_coordinator(const char *nodes, const std::vector<std::string> &command)
+{
+    (void)nodes;   // Unused
+    (void)command; // Unused
+    std::cerr << "The coordinator is not supported on Windows." << std::endl;
+    return 1;
+}
+
+#else
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// How long a node may take to answer one command. A start is answered after the first frame is written.
+static const int coordinatorReplyTimeoutSec = 10;
+
+typedef struct
+{
+    std::string address;
+    std::string host;
+    std::string port;
+    int fd;
+    std::string sync;
+    // Last command: its response line, when it was sent relative to the first send of the batch, and its round trip.
+    std::string response;
+    double sent_ms;
+    double ack_ms;
+    bool ok;
+} rig_node_t;
+
+static bool parse_nodes(const char *nodes, std::vector<rig_node_t> *rig)
+{
+    std::istringstream stream(nodes);
+    std::string address;
+    while (std::getline(stream, address, ','))
+    {
+        size_t colon = address.rfind(':');
+        if (colon == std::string::npos || colon == 0 || colon + 1 == address.size())
+        {
+            std::cerr << "Node address must be host:port: " << address << std::endl;
+            return false;
+        }
+        rig_node_t node;
+        node.address = address;
+        node.host = address.substr(0, colon);
+        node.port = address.substr(colon + 1);
+        node.fd = -1;
+        node.sent_ms = 0;
+        node.ack_ms = 0;
+        node.ok = false;
+        rig->push_back(node);
+    }
+    return !rig->empty();
+}
+
+static bool connect_node(rig_node_t *node)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addresses = NULL;
+    if (getaddrinfo(node->host.c_str(), node->port.c_str(), &hints, &addresses) != 0)
+    {
+        node->response = "ERR unknown host";
+        return false;
+    }
+
+    for (struct addrinfo *address = addresses; address != NULL && node->fd < 0; address = address->ai_next)
+    {
+        int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+        if (connect(fd, address->ai_addr, address->ai_addrlen) != 0)
+        {
+            close(fd);
+            continue;
+        }
+        struct timeval timeout;
+        timeout.tv_sec = coordinatorReplyTimeoutSec;
+        timeout.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        node->fd = fd;
+    }
+    freeaddrinfo(addresses);
+
+    if (node->fd < 0)
+    {
+        node->response = std::string("ERR unable to connect: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+static bool send_line(rig_node_t *node, const std::string &line)
+{
+    std::string data = line + "\n";
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t result = send(node->fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            return false;
+        }
+        sent += (size_t)result;
+    }
+    return true;
+}
+
+static bool receive_line(rig_node_t *node, std::string *line)
+{
+    line->clear();
+    char c;
+    for (;;)
+    {
+        ssize_t result = recv(node->fd, &c, 1, 0);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            return false;
+        }
+        if (c == '\n')
+        {
+            return true;
+        }
+        line->push_back(c);
+    }
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+// Sends each node its command line in the given order, then collects the replies in parallel. Nodes that are not
+// connected or have no line are skipped. Returns true if every node that got a command answered OK.
+static bool send_to_nodes(std::vector<rig_node_t> *rig,
+                          const std::vector<size_t> &order,
+                          const std::vector<std::string> &lines)
+{
+    auto batch_start = std::chrono::steady_clock::now();
+    std::vector<std::chrono::steady_clock::time_point> sent_at(rig->size());
+    std::vector<size_t> waiting;
+    bool all_ok = true;
+    for (size_t index : order)
+    {
+        rig_node_t *node = &(*rig)[index];
+        if (node->fd < 0 || lines[index].empty())
+        {
+            continue;
+        }
+        sent_at[index] = std::chrono::steady_clock::now();
+        node->sent_ms = elapsed_ms(batch_start);
+        if (!send_line(node, lines[index]))
+        {
+            node->ok = false;
+            node->response = "ERR connection lost";
+            all_ok = false;
+            continue;
+        }
+        waiting.push_back(index);
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t index : waiting)
+    {
+        threads.emplace_back([rig, index, &sent_at]() {
+            rig_node_t *node = &(*rig)[index];
+            if (!receive_line(node, &node->response))
+            {
+                node->response = errno == EAGAIN || errno == EWOULDBLOCK ? "ERR timed out" : "ERR connection lost";
+            }
+            node->ack_ms = elapsed_ms(sent_at[index]);
+            node->ok = node->response.compare(0, 2, "OK") == 0;
+        });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    for (size_t index : waiting)
+    {
+        all_ok = all_ok && (*rig)[index].ok;
+    }
+    return all_ok;
+}
+
+static bool send_to_all(std::vector<rig_node_t> *rig, const std::vector<std::string> &lines)
+{
+    std::vector<size_t> order;
+    for (size_t i = 0; i < rig->size(); i++)
+    {
+        order.push_back(i);
+    }
+    return send_to_nodes(rig, order, lines);
+}
+
+// Value of "key=value" in a response line, empty if missing.
+static std::string response_field(const std::string &response, const char *key)
+{
+    std::istringstream stream(response);
+    std::string token;
+    std::string prefix = std::string(key) + "=";
+    while (stream >> token)
+    {
+        if (token.compare(0, prefix.size(), prefix) == 0)
+        {
+            return token.substr(prefix.size());
+        }
+    }
+    return std::string();
+}
+
+static std::string expand_node_pattern(const std::string &pattern, size_t index)
+{
+    std::string result = pattern;
+    size_t position;
+    while ((position = result.find("{node}")) != std::string::npos)
+    {
+        result.replace(position, 6, std::to_string(index));
+    }
+    return result;
+}
+
+// Builds "<verb> <file> [seconds]" for every node from the command arguments.
+static std::vector<std::string> take_lines(const char *verb,
+                                           const std::vector<std::string> &command,
+                                           size_t node_count)
+{
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < node_count; i++)
+    {
+        std::string line = verb;
+        for (size_t arg = 1; arg < command.size(); arg++)
+        {
+            line += " " + (arg == 1 ? expand_node_pattern(command[arg], i) : command[arg]);
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+static void print_responses(const std::vector<rig_node_t> &rig)
+{
+    for (const rig_node_t &node : rig)
+    {
+        std::cout << std::left << std::setw(22) << node.address << std::right << " ack " << std::fixed
+                  << std::setprecision(1) << std::setw(7) << node.ack_ms << " ms  " << node.response << std::endl;
+    }
+}
+
+static void print_status_table(const std::vector<rig_node_t> &rig)
+{
+    std::cout << std::left << std::setw(22) << "node" << std::setw(10) << "state" << std::setw(12) << "sync"
+              << std::right << std::setw(8) << "frames" << std::setw(7) << "drops" << std::setw(7) << "fps"
+              << std::setw(11) << "free MB" << "  file" << std::endl;
+    for (const rig_node_t &node : rig)
+    {
+        if (!node.ok)
+        {
+            std::cout << std::left << std::setw(22) << node.address << node.response << std::endl;
+            continue;
+        }
+        std::cout << std::left << std::setw(22) << node.address << std::setw(10)
+                  << response_field(node.response, "state") << std::setw(12) << response_field(node.response, "sync")
+                  << std::right << std::setw(8) << response_field(node.response, "frames") << std::setw(7)
+                  << response_field(node.response, "drops") << std::setw(7) << response_field(node.response, "fps")
+                  << std::setw(11) << response_field(node.response, "disk_free_mb") << "  "
+                  << response_field(node.response, "file") << std::endl;
+    }
+}
+
+// Asks every node for its sync role and returns the nodes in start order: subordinates, then the master and
+// standalone nodes.
+static std::vector<size_t> subordinates_first(std::vector<rig_node_t> *rig, size_t *subordinate_count)
+{
+    std::vector<std::string> status_lines(rig->size(), "status");
+    send_to_all(rig, status_lines);
+    std::vector<size_t> order;
+    for (size_t i = 0; i < rig->size(); i++)
+    {
+        (*rig)[i].sync = response_field((*rig)[i].response, "sync");
+        if ((*rig)[i].sync == "subordinate")
+        {
+            order.push_back(i);
+        }
+    }
+    *subordinate_count = order.size();
+    for (size_t i = 0; i < rig->size(); i++)
+    {
+        if ((*rig)[i].sync != "subordinate")
+        {
+            order.push_back(i);
+        }
+    }
+    return order;
+}
+
+// Arms the nodes. A node starts its cameras with its first take, so the subordinates are armed, and their cameras
+// waiting for the sync signal, before the master is armed and starts sending it.
+static bool arm_nodes(std::vector<rig_node_t> *rig, const std::vector<std::string> &lines)
+{
+    size_t subordinate_count;
+    std::vector<size_t> order = subordinates_first(rig, &subordinate_count);
+    std::vector<size_t> subordinates(order.begin(), order.begin() + subordinate_count);
+    std::vector<size_t> others(order.begin() + subordinate_count, order.end());
+    bool all_ok = send_to_nodes(rig, subordinates, lines);
+    all_ok = send_to_nodes(rig, others, lines) && all_ok;
+    print_responses(*rig);
+    return all_ok;
+}
+
+// Starts the armed takes: subordinates first so they are writing before the master's first frame of the take, then
+// the master and standalone nodes. The start reply of a node arrives once its first frame is written.
+static bool start_nodes(std::vector<rig_node_t> *rig, const std::vector<std::string> &lines)
+{
+    size_t subordinate_count;
+    std::vector<size_t> order = subordinates_first(rig, &subordinate_count);
+
+    bool all_ok = send_to_nodes(rig, order, lines);
+    print_responses(*rig);
+
+    // Latency from the command reaching a node to its first written frame, and the spread of the moments the nodes
+    // confirmed recording on the coordinator's clock.
+    double min_latency = 0, max_latency = 0, sum_latency = 0;
+    double first_ack = 0, last_ack = 0;
+    size_t started = 0;
+    for (const rig_node_t &node : *rig)
+    {
+        if (!node.ok)
+        {
+            continue;
+        }
+        double latency_ms = atof(response_field(node.response, "latency_us").c_str()) / 1000.0;
+        double ack_at = node.sent_ms + node.ack_ms;
+        min_latency = started == 0 ? latency_ms : std::min(min_latency, latency_ms);
+        max_latency = started == 0 ? latency_ms : std::max(max_latency, latency_ms);
+        first_ack = started == 0 ? ack_at : std::min(first_ack, ack_at);
+        last_ack = started == 0 ? ack_at : std::max(last_ack, ack_at);
+        sum_latency += latency_ms;
+        started++;
+    }
+    if (started > 0)
+    {
+        std::cout << "Started " << started << "/" << rig->size() << " nodes. Start latency min " << std::fixed
+                  << std::setprecision(1) << min_latency << " ms, mean " << sum_latency / started << " ms, max "
+                  << max_latency << " ms; start spread " << last_ack - first_ack << " ms" << std::endl;
+    }
+    return all_ok;
+}
+
+int run_coordinator(const char *nodes, const std::vector<std::string> &command)
+{
+    std::vector<rig_node_t> rig;
+    if (command.empty() || !parse_nodes(nodes, &rig))
+    {
+        std::cerr << "Usage: k4arecorder --coordinate host:port[,host:port...] "
+                     "status|arm <output.mkv> [seconds]|start|take <output.mkv> [seconds]|stop|quit"
+                  << std::endl;
+        return 1;
+    }
+
+    std::vector<std::thread> threads;
+    for (rig_node_t &node : rig)
+    {
+        threads.emplace_back([&node]() { node.ok = connect_node(&node); });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    bool all_ok = true;
+    for (const rig_node_t &node : rig)
+    {
+        if (!node.ok)
+        {
+            std::cerr << node.address << ": " << node.response << std::endl;
+            all_ok = false;
+        }
+    }
+
+    const char *verb = command[0].c_str();
+    if (string_compare(verb, "status") == 0)
+    {
+        all_ok = send_to_all(&rig, std::vector<std::string>(rig.size(), "status")) && all_ok;
+        print_status_table(rig);
+    }
+    else if (string_compare(verb, "arm") == 0 && command.size() >= 2)
+    {
+        all_ok = arm_nodes(&rig, take_lines("arm", command, rig.size())) && all_ok;
+    }
+    else if (string_compare(verb, "start") == 0)
+    {
+        all_ok = start_nodes(&rig, take_lines("start", command, rig.size())) && all_ok;
+    }
+    else if (string_compare(verb, "take") == 0 && command.size() >= 2)
+    {
+        bool armed = arm_nodes(&rig, take_lines("arm", command, rig.size()));
+        if (armed && all_ok)
+        {
+            all_ok = start_nodes(&rig, std::vector<std::string>(rig.size(), "start"));
+        }
+        else
+        {
+            // Leave no node armed when the rig cannot start as a whole.
+            send_to_all(&rig, std::vector<std::string>(rig.size(), "stop"));
+            all_ok = false;
+        }
+    }
+    else if (string_compare(verb, "stop") == 0 || string_compare(verb, "quit") == 0)
+    {
+        all_ok = send_to_all(&rig, std::vector<std::string>(rig.size(), command[0])) && all_ok;
+        print_responses(rig);
+    }
+    else
+    {
+        std::cerr << "Unknown coordinator command: " << command[0] << std::endl;
+        all_ok = false;
+    }
+
+    for (rig_node_t &node : rig)
+    {
+        if (node.fd >= 0)
+        {
+            close(node.fd);
+        }
+    }
+    return all_ok ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,22 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef COORDINATOR_H
+#define COORDINATOR_H
+
+#include <string>
+#include <vector>
+
+// Drives the session mode of several recorder nodes (k4arecorder --session --control-port N) at once. nodes is a
+// comma-separated list of host:port; command is one of
+//   status                      print a health table of every node
+//   arm <output.mkv> [seconds]  create the file on every node
+//   start [<output.mkv> [seconds]]
+//                               start the armed takes, subordinates before the master
+//   take <output.mkv> [seconds] arm, then start
+//   stop | quit
+// "{node}" in a file name is replaced by the node's position in the list. Commands go to all nodes in parallel and
+// the round trip and start latency of each node are reported. Returns 0 if every node answered OK.
+int run_coordinator(const char *nodes, const std::vector<std::string> &command);
+
+#endif /* COORDINATOR_H */
@@ -0,0 +1,637 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "depth_delta.h"
+#include "recorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+#include <k4arecord/record.h>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define DEPTH_DELTA_NEON
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DEPTH_DELTA_SSE2
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define DEPTH_DELTA_SSSE3
+#endif
+#endif
+
+static const uint32_t depthDeltaVersion = 1;
+
+// For every 8-bit change mask: the byte shuffle that moves the selected 16-bit lanes to the front (0x80 clears a
+// byte), and the number of selected lanes.
+typedef struct
+{
+    uint8_t shuffle[256][16];
+    uint8_t count[256];
+} pack_table_t;
+
+static const pack_table_t *get_pack_table()
+{
+    static pack_table_t table;
+    static bool initialized = [] {
+        for (int bits = 0; bits < 256; bits++)
+        {
+            int lane = 0;
+            memset(table.shuffle[bits], 0x80, sizeof(table.shuffle[bits]));
+            for (int i = 0; i < 8; i++)
+            {
+                if (bits & (1 << i))
+                {
+                    table.shuffle[bits][lane * 2] = (uint8_t)(i * 2);
+                    table.shuffle[bits][lane * 2 + 1] = (uint8_t)(i * 2 + 1);
+                    lane++;
+                }
+            }
+            table.count[bits] = (uint8_t)lane;
+        }
+        return true;
+    }();
+    (void)initialized; // Unused
+    return &table;
+}
+
+size_t depth_delta_compare_pack_scalar(const uint16_t *current,
+                                       uint16_t *reference,
+                                       size_t count,
+                                       uint16_t threshold,
+                                       uint8_t *mask,
+                                       uint16_t *packed)
+{
+    size_t packed_count = 0;
+    memset(mask, 0, (count + 7) / 8);
+    for (size_t i = 0; i < count; i++)
+    {
+        uint16_t diff = (uint16_t)(current[i] > reference[i] ? current[i] - reference[i] : reference[i] - current[i]);
+        if (diff > threshold)
+        {
+            mask[i / 8] |= (uint8_t)(1 << (i % 8));
+            packed[packed_count++] = current[i];
+            reference[i] = current[i];
+        }
+    }
+    return packed_count;
+}
+
+size_t depth_delta_compare_pack(const uint16_t *current,
+                                uint16_t *reference,
+                                size_t count,
+                                uint16_t threshold,
+                                uint8_t *mask,
+                                uint16_t *packed)
+{
+#if defined(DEPTH_DELTA_NEON) || defined(DEPTH_DELTA_SSE2)
+    const pack_table_t *table = get_pack_table();
+    size_t packed_count = 0;
+    size_t vector_count = count & ~(size_t)7;
+
+#if defined(DEPTH_DELTA_NEON)
+    static const uint16_t laneBits[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint16x8_t lane_bits = vld1q_u16(laneBits);
+    const uint16x8_t threshold_v = vdupq_n_u16(threshold);
+#else
+    const __m128i threshold_v = _mm_set1_epi16((short)threshold);
+    const __m128i zero = _mm_setzero_si128();
+#endif
+
+    for (size_t i = 0; i < vector_count; i += 8)
+    {
+#if defined(DEPTH_DELTA_NEON)
+        uint16x8_t cur = vld1q_u16(current + i);
+        uint16x8_t ref = vld1q_u16(reference + i);
+        uint16x8_t changed = vcgtq_u16(vabdq_u16(cur, ref), threshold_v);
+        uint8_t bits = (uint8_t)vaddvq_u16(vandq_u16(changed, lane_bits));
+#else
+        __m128i cur = _mm_loadu_si128((const __m128i *)(current + i));
+        __m128i ref = _mm_loadu_si128((const __m128i *)(reference + i));
+        // Unsigned |cur - ref| <= threshold, via saturating subtraction.
+        __m128i diff = _mm_or_si128(_mm_subs_epu16(cur, ref), _mm_subs_epu16(ref, cur));
+        __m128i same = _mm_cmpeq_epi16(_mm_subs_epu16(diff, threshold_v), zero);
+        uint8_t bits = (uint8_t)~_mm_movemask_epi8(_mm_packs_epi16(same, zero));
+#endif
+        mask[i / 8] = bits;
+        // A static scene leaves most groups unchanged; they cost only the compare.
+        if (bits == 0)
+        {
+            continue;
+        }
+
+#if defined(DEPTH_DELTA_NEON)
+        vst1q_u16(reference + i, vbslq_u16(changed, cur, ref));
+        vst1q_u8((uint8_t *)(packed + packed_count),
+                 vqtbl1q_u8(vreinterpretq_u8_u16(cur), vld1q_u8(table->shuffle[bits])));
+#else
+        _mm_storeu_si128((__m128i *)(reference + i),
+                         _mm_or_si128(_mm_and_si128(same, ref), _mm_andnot_si128(same, cur)));
+#if defined(DEPTH_DELTA_SSSE3)
+        _mm_storeu_si128((__m128i *)(packed + packed_count),
+                         _mm_shuffle_epi8(cur, _mm_loadu_si128((const __m128i *)table->shuffle[bits])));
+#else
+        for (int lane = 0, out = 0; lane < 8; lane++)
+        {
+            if (bits & (1 << lane))
+            {
+                packed[packed_count + out++] = current[i + lane];
+            }
+        }
+#endif
+#endif
+        packed_count += table->count[bits];
+    }
+
+    if (vector_count < count)
+    {
+        packed_count += depth_delta_compare_pack_scalar(current + vector_count,
+                                                        reference + vector_count,
+                                                        count - vector_count,
+                                                        threshold,
+                                                        mask + vector_count / 8,
+                                                        packed + packed_count);
+    }
+    return packed_count;
+#else
+    return depth_delta_compare_pack_scalar(current, reference, count, threshold, mask, packed);
+#endif
+}
+
+depth_delta_encoder::depth_delta_encoder(uint32_t width,
+                                         uint32_t height,
+                                         uint32_t keyframe_interval,
+                                         uint16_t threshold) :
+    m_reference((size_t)width * height),
+    m_mask(((size_t)width * height + 7) / 8),
+    m_packed((size_t)width * height + 8),
+    m_frame_index(0)
+{
+    m_header.version = depthDeltaVersion;
+    m_header.width = width;
+    m_header.height = height;
+    m_header.keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+    m_header.threshold = threshold;
+}
+
+void depth_delta_encoder::encode(const uint16_t *depth, std::vector<uint8_t> *block)
+{
+    size_t pixels = m_reference.size();
+    depth_delta_block_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.keyframe = m_frame_index % m_header.keyframe_interval == 0;
+    header.frame_index = m_frame_index++;
+
+    if (header.keyframe)
+    {
+        memcpy(m_reference.data(), depth, pixels * sizeof(uint16_t));
+        header.value_count = (uint32_t)pixels;
+        block->resize(sizeof(header) + pixels * sizeof(uint16_t));
+        memcpy(block->data() + sizeof(header), depth, pixels * sizeof(uint16_t));
+    }
+    else
+    {
+        size_t changed = depth_delta_compare_pack(
+            depth, m_reference.data(), pixels, (uint16_t)m_header.threshold, m_mask.data(), m_packed.data());
+        header.value_count = (uint32_t)changed;
+        block->resize(sizeof(header) + m_mask.size() + changed * sizeof(uint16_t));
+        memcpy(block->data() + sizeof(header), m_mask.data(), m_mask.size());
+        memcpy(block->data() + sizeof(header) + m_mask.size(), m_packed.data(), changed * sizeof(uint16_t));
+    }
+    memcpy(block->data(), &header, sizeof(header));
+}
+
+depth_delta_decoder::depth_delta_decoder(const depth_delta_track_header_t *header) :
+    m_header(*header),
+    m_reference((size_t)header->width * header->height),
+    m_have_keyframe(false),
+    m_next_frame_index(0)
+{
+}
+
+bool depth_delta_decoder::decode(const uint8_t *block, size_t size, uint16_t *depth)
+{
+    depth_delta_block_header_t header;
+    if (size < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, block, sizeof(header));
+    const uint8_t *payload = block + sizeof(header);
+    size_t pixels = m_reference.size();
+
+    if (header.keyframe)
+    {
+        if (header.value_count != pixels || size != sizeof(header) + pixels * sizeof(uint16_t))
+        {
+            return false;
+        }
+        memcpy(m_reference.data(), payload, pixels * sizeof(uint16_t));
+        m_have_keyframe = true;
+    }
+    else
+    {
+        size_t mask_size = (pixels + 7) / 8;
+        if (!m_have_keyframe || header.frame_index != m_next_frame_index ||
+            size != sizeof(header) + mask_size + (size_t)header.value_count * sizeof(uint16_t))
+        {
+            return false;
+        }
+        const uint8_t *mask = payload;
+        const uint8_t *values = payload + mask_size;
+        size_t value = 0;
+        for (size_t byte = 0; byte < mask_size; byte++)
+        {
+            uint8_t bits = mask[byte];
+            for (int bit = 0; bits != 0; bit++, bits >>= 1)
+            {
+                if ((bits & 1) == 0)
+                {
+                    continue;
+                }
+                size_t pixel = byte * 8 + bit;
+                if (value >= header.value_count || pixel >= pixels)
+                {
+                    return false;
+                }
+                memcpy(&m_reference[pixel], values + value * sizeof(uint16_t), sizeof(uint16_t));
+                value++;
+            }
+        }
+        if (value != header.value_count)
+        {
+            return false;
+        }
+    }
+
+    m_next_frame_index = header.frame_index + 1;
+    memcpy(depth, m_reference.data(), pixels * sizeof(uint16_t));
+    return true;
+}
+
+depth_delta_reader::depth_delta_reader() : m_playback(NULL), m_pending(false), m_pending_timestamp_usec(0)
+{
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+depth_delta_reader::~depth_delta_reader()
+{
+    close();
+}
+
+bool depth_delta_reader::open(const char *path)
+{
+    close();
+    if (K4A_FAILED(k4a_playback_open(path, &m_playback)))
+    {
+        std::cerr << "Unable to open recording: " << path << std::endl;
+        m_playback = NULL;
+        return false;
+    }
+
+    size_t size = sizeof(m_header);
+    if (!k4a_playback_check_track_exists(m_playback, depthDeltaTrack) ||
+        k4a_playback_track_get_codec_context(m_playback, depthDeltaTrack, (uint8_t *)&m_header, &size) !=
+            K4A_BUFFER_RESULT_SUCCEEDED ||
+        size != sizeof(m_header) || m_header.version != depthDeltaVersion)
+    {
+        std::cerr << path << " has no " << depthDeltaTrack << " track of version " << depthDeltaVersion << std::endl;
+        close();
+        return false;
+    }
+
+    m_decoder.reset(new depth_delta_decoder(&m_header));
+    m_scratch.resize((size_t)m_header.width * m_header.height);
+    m_pending = false;
+    return true;
+}
+
+void depth_delta_reader::close()
+{
+    if (m_playback != NULL)
+    {
+        k4a_playback_close(m_playback);
+        m_playback = NULL;
+    }
+    m_decoder.reset();
+    m_pending = false;
+}
+
+bool depth_delta_reader::decode_block(k4a_playback_data_block_t block, uint16_t *depth)
+{
+    bool result = m_decoder->decode(k4a_playback_data_block_get_buffer(block),
+                                    k4a_playback_data_block_get_buffer_size(block),
+                                    depth);
+    if (!result)
+    {
+        std::cerr << "Runtime error: corrupt " << depthDeltaTrack << " block at "
+                  << k4a_playback_data_block_get_device_timestamp_usec(block) << " usec" << std::endl;
+    }
+    return result;
+}
+
+static bool is_keyframe_block(k4a_playback_data_block_t block)
+{
+    return k4a_playback_data_block_get_buffer_size(block) >= sizeof(depth_delta_block_header_t) &&
+           k4a_playback_data_block_get_buffer(block)[0] != 0;
+}
+
+bool depth_delta_reader::seek(uint64_t device_timestamp_usec)
+{
+    m_pending = false;
+    if (m_playback == NULL ||
+        K4A_FAILED(k4a_playback_seek_timestamp(
+            m_playback, (int64_t)device_timestamp_usec, K4A_PLAYBACK_SEEK_DEVICE_TIME)))
+    {
+        return false;
+    }
+
+    // The target is the first block at or after the timestamp. Reading backwards returns the block before the one
+    // read last, so the walk back to the keyframe goes on from the block before the target.
+    k4a_playback_data_block_t block;
+    if (k4a_playback_get_next_data_block(m_playback, depthDeltaTrack, &block) != K4A_STREAM_RESULT_SUCCEEDED)
+    {
+        return false;
+    }
+    uint64_t target_usec = k4a_playback_data_block_get_device_timestamp_usec(block);
+    while (!is_keyframe_block(block))
+    {
+        k4a_playback_data_block_release(block);
+        if (k4a_playback_get_previous_data_block(m_playback, depthDeltaTrack, &block) != K4A_STREAM_RESULT_SUCCEEDED)
+        {
+            return false;
+        }
+    }
+
+    // Decode the keyframe, then forward up to and including the target.
+    bool decoded = decode_block(block, m_scratch.data());
+    m_pending_timestamp_usec = k4a_playback_data_block_get_device_timestamp_usec(block);
+    k4a_playback_data_block_release(block);
+    while (decoded && m_pending_timestamp_usec < target_usec)
+    {
+        if (k4a_playback_get_next_data_block(m_playback, depthDeltaTrack, &block) != K4A_STREAM_RESULT_SUCCEEDED)
+        {
+            return false;
+        }
+        decoded = decode_block(block, m_scratch.data());
+        m_pending_timestamp_usec = k4a_playback_data_block_get_device_timestamp_usec(block);
+        k4a_playback_data_block_release(block);
+    }
+    m_pending = decoded;
+    return decoded;
+}
+
+bool depth_delta_reader::next_frame(uint16_t *depth, uint64_t *device_timestamp_usec)
+{
+    if (m_playback == NULL)
+    {
+        return false;
+    }
+    if (m_pending)
+    {
+        memcpy(depth, m_scratch.data(), m_scratch.size() * sizeof(uint16_t));
+        *device_timestamp_usec = m_pending_timestamp_usec;
+        m_pending = false;
+        return true;
+    }
+
+    k4a_playback_data_block_t block;
+    if (k4a_playback_get_next_data_block(m_playback, depthDeltaTrack, &block) != K4A_STREAM_RESULT_SUCCEEDED)
+    {
+        return false;
+    }
+    bool decoded = decode_block(block, depth);
+    *device_timestamp_usec = k4a_playback_data_block_get_device_timestamp_usec(block);
+    k4a_playback_data_block_release(block);
+    return decoded;
+}
+
+// Benchmark input: a wall and floor at 1-4 m with +-2 mm of per-pixel noise, 0.2% of pixels flickering between
+// valid and invalid as at depth edges, and a subject crossing the view.
+static void generate_benchmark_frame(uint32_t width, uint32_t height, uint32_t frame, uint16_t *depth, uint32_t *seed)
+{
+    uint32_t size = height / 3;
+    int32_t subject_x = (int32_t)((frame * 6) % (width + size)) - (int32_t)size;
+    int32_t subject_y = (int32_t)(height - size) / 2;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            *seed = *seed * 1664525 + 1013904223;
+            uint32_t noise = *seed >> 16;
+            bool subject = (int32_t)x >= subject_x && (int32_t)x < subject_x + (int32_t)size &&
+                           (int32_t)y >= subject_y && (int32_t)y < subject_y + (int32_t)size;
+            uint16_t value = (uint16_t)(subject ? 1500 + (x + y) % 40 : 4000 - (3000 * y) / height);
+            value = (uint16_t)(value + noise % 5 - 2);
+            depth[(size_t)y * width + x] = noise % 500 == 0 ? 0 : value;
+        }
+    }
+}
+
+// Device timestamp of a frame written by check_seek().
+static uint64_t seek_check_timestamp_usec(uint32_t frame)
+{
+    return 1000000 + (uint64_t)frame * 33333;
+}
+
+// Writes the frames to a temporary recording through k4arecord, then seeks a depth_delta_reader to the first frame, a
+// keyframe, a frame in the middle of a keyframe interval (by a timestamp between it and the frame before), the last
+// frame of an interval and the second to last frame. After each seek, the next two frames must have the expected
+// timestamps, match decoding the track from its start, and differ from the source by at most the threshold.
+static bool check_seek(const uint16_t *frames,
+                       uint32_t width,
+                       uint32_t height,
+                       uint32_t frame_count,
+                       uint32_t keyframe_interval,
+                       uint16_t threshold)
+{
+    static const char path[] = ".k4arecorder-depth-delta-check.mkv";
+    size_t pixels = (size_t)width * height;
+
+    std::vector<uint32_t> targets;
+    std::vector<uint64_t> seek_usec;
+    uint32_t candidates[] = { 0,
+                              keyframe_interval,
+                              keyframe_interval + keyframe_interval / 2,
+                              2 * keyframe_interval - 1,
+                              frame_count - 2 };
+    std::map<uint32_t, std::vector<uint16_t>> expected;
+    for (uint32_t target : candidates)
+    {
+        if (target + 1 < frame_count)
+        {
+            targets.push_back(target);
+            bool between = target == keyframe_interval + keyframe_interval / 2 && target > 0;
+            seek_usec.push_back(seek_check_timestamp_usec(target) - (between ? 10000 : 0));
+            expected[target].clear();
+            expected[target + 1].clear();
+        }
+    }
+
+    depth_delta_encoder encoder(width, height, keyframe_interval, threshold);
+    depth_delta_decoder decoder(encoder.track_header());
+    k4a_record_t recording;
+    if (K4A_FAILED(k4a_record_create(path, NULL, K4A_DEVICE_CONFIG_INIT_DISABLE_ALL, &recording)))
+    {
+        std::cerr << "Runtime error: unable to create " << path << std::endl;
+        return false;
+    }
+    k4a_record_subtitle_settings_t settings;
+    settings.high_freq_data = false;
+    bool ok = K4A_SUCCEEDED(k4a_record_add_custom_subtitle_track(recording,
+                                                                 depthDeltaTrack,
+                                                                 depthDeltaCodec,
+                                                                 (const uint8_t *)encoder.track_header(),
+                                                                 sizeof(depth_delta_track_header_t),
+                                                                 &settings)) &&
+              K4A_SUCCEEDED(k4a_record_write_header(recording));
+    std::vector<uint8_t> block;
+    std::vector<uint16_t> decoded(pixels);
+    for (uint32_t frame = 0; ok && frame < frame_count; frame++)
+    {
+        encoder.encode(&frames[frame * pixels], &block);
+        ok = decoder.decode(block.data(), block.size(), decoded.data()) &&
+             K4A_SUCCEEDED(k4a_record_write_custom_track_data(
+                 recording, depthDeltaTrack, seek_check_timestamp_usec(frame), block.data(), block.size()));
+        if (expected.count(frame) != 0)
+        {
+            expected[frame] = decoded;
+        }
+    }
+    ok = ok && K4A_SUCCEEDED(k4a_record_flush(recording));
+    k4a_record_close(recording);
+
+    depth_delta_reader reader;
+    ok = ok && reader.open(path);
+    std::vector<uint16_t> depth(pixels);
+    for (size_t i = 0; ok && i < targets.size(); i++)
+    {
+        ok = reader.seek(seek_usec[i]);
+        for (uint32_t frame = targets[i]; ok && frame <= targets[i] + 1; frame++)
+        {
+            uint64_t timestamp_usec = 0;
+            ok = reader.next_frame(depth.data(), &timestamp_usec) &&
+                 timestamp_usec == seek_check_timestamp_usec(frame) && depth == expected[frame];
+            for (size_t pixel = 0; ok && pixel < pixels; pixel++)
+            {
+                ok = abs((int)depth[pixel] - (int)frames[frame * pixels + pixel]) <= threshold;
+            }
+        }
+        if (!ok)
+        {
+            std::cerr << "Seek to frame " << targets[i] << " of " << path << " returned wrong depth" << std::endl;
+        }
+    }
+    reader.close();
+    std::remove(path);
+    return ok;
+}
+
+int run_depth_delta_benchmark(uint32_t keyframe_interval, uint16_t threshold)
+{
+    static const struct
+    {
+        k4a_depth_mode_t mode;
+        const char *name;
+    } modes[] = { { K4A_DEPTH_MODE_NFOV_2X2BINNED, "NFOV_2X2BINNED" },
+                  { K4A_DEPTH_MODE_NFOV_UNBINNED, "NFOV_UNBINNED" },
+                  { K4A_DEPTH_MODE_WFOV_2X2BINNED, "WFOV_2X2BINNED" },
+                  { K4A_DEPTH_MODE_WFOV_UNBINNED, "WFOV_UNBINNED" } };
+    static const uint32_t frameCount = 150;
+
+    std::cout << "Depth delta benchmark: " << frameCount << " frames per mode, keyframe every " << keyframe_interval
+              << " frames, threshold " << threshold << " mm" << std::endl;
+#if defined(DEPTH_DELTA_NEON)
+    std::cout << "Kernel: NEON" << std::endl;
+#elif defined(DEPTH_DELTA_SSSE3)
+    std::cout << "Kernel: SSSE3" << std::endl;
+#elif defined(DEPTH_DELTA_SSE2)
+    std::cout << "Kernel: SSE2" << std::endl;
+#else
+    std::cout << "Kernel: scalar" << std::endl;
+#endif
+
+    int status = 0;
+    for (const auto &mode : modes)
+    {
+        int width, height;
+        get_depth_mode_size(mode.mode, &width, &height);
+        size_t pixels = (size_t)width * height;
+
+        std::vector<uint16_t> frames(pixels * frameCount);
+        uint32_t seed = 1;
+        for (uint32_t frame = 0; frame < frameCount; frame++)
+        {
+            generate_benchmark_frame(width, height, frame, &frames[frame * pixels], &seed);
+        }
+
+        depth_delta_encoder encoder(width, height, keyframe_interval, threshold);
+        depth_delta_decoder decoder(encoder.track_header());
+        std::vector<uint8_t> block;
+        std::vector<uint16_t> decoded(pixels);
+        uint64_t encoded_bytes = 0;
+        double encode_seconds = 0;
+        uint32_t max_error = 0;
+        bool decode_ok = true;
+        for (uint32_t frame = 0; frame < frameCount; frame++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            encoder.encode(&frames[frame * pixels], &block);
+            encode_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            encoded_bytes += block.size();
+
+            decode_ok = decoder.decode(block.data(), block.size(), decoded.data()) && decode_ok;
+            for (size_t i = 0; i < pixels; i++)
+            {
+                uint32_t error = (uint32_t)abs((int)decoded[i] - (int)frames[frame * pixels + i]);
+                max_error = std::max(max_error, error);
+            }
+        }
+
+        // The vector and the scalar kernel on the same predicted frames; their output must match.
+        std::vector<uint16_t> reference_vector(frames.begin(), frames.begin() + pixels);
+        std::vector<uint16_t> reference_scalar(reference_vector);
+        std::vector<uint8_t> mask_vector((pixels + 7) / 8), mask_scalar((pixels + 7) / 8);
+        std::vector<uint16_t> packed_vector(pixels + 8), packed_scalar(pixels + 8);
+        double vector_seconds = 0, scalar_seconds = 0;
+        bool kernels_match = true;
+        for (uint32_t frame = 1; frame < frameCount; frame++)
+        {
+            const uint16_t *current = &frames[frame * pixels];
+            auto start = std::chrono::steady_clock::now();
+            size_t vector_count = depth_delta_compare_pack(
+                current, reference_vector.data(), pixels, threshold, mask_vector.data(), packed_vector.data());
+            auto middle = std::chrono::steady_clock::now();
+            size_t scalar_count = depth_delta_compare_pack_scalar(
+                current, reference_scalar.data(), pixels, threshold, mask_scalar.data(), packed_scalar.data());
+            auto end = std::chrono::steady_clock::now();
+            vector_seconds += std::chrono::duration<double>(middle - start).count();
+            scalar_seconds += std::chrono::duration<double>(end - middle).count();
+            kernels_match = kernels_match && vector_count == scalar_count && mask_vector == mask_scalar &&
+                            memcmp(packed_vector.data(), packed_scalar.data(), vector_count * sizeof(uint16_t)) == 0;
+        }
+
+        bool seek_ok = check_seek(frames.data(), width, height, frameCount, keyframe_interval, threshold);
+
+        uint64_t raw_bytes = (uint64_t)pixels * sizeof(uint16_t) * frameCount;
+        bool ok = decode_ok && kernels_match && max_error <= threshold && seek_ok;
+        std::cout << std::left << std::setw(15) << mode.name << std::right << std::setw(5) << width << "x"
+                  << std::setw(4) << height << std::fixed << std::setprecision(2) << "  ratio "
+                  << (double)raw_bytes / encoded_bytes << ":1  encode " << 1000 * encode_seconds / frameCount
+                  << " ms/frame  kernel " << 1000 * vector_seconds / (frameCount - 1) << " ms (scalar "
+                  << 1000 * scalar_seconds / (frameCount - 1) << " ms)  max error " << max_error << " mm  seek "
+                  << (seek_ok ? "ok" : "wrong") << (ok ? "" : "  FAILED") << std::endl;
+        if (!ok)
+        {
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,152 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef DEPTH_DELTA_H
+#define DEPTH_DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include <k4arecord/playback.h>
+
+// Temporal depth coding for fixed cameras, stored in the "DEPTH_DELTA" custom track (codec "S_K4A/DEPTH_DELTA").
+//
+// Every keyframe_interval-th frame is a keyframe holding the full DEPTH16 image. Each other frame stores only the
+// pixels that differ from the decoder's current reconstruction by more than threshold millimeters: a bitmask with one
+// bit per pixel (LSB first) followed by the new values of the set pixels. Pixels within the threshold keep the value
+// of the last frame that stored them, so decoded depth differs from the camera by at most threshold, without drift.
+// A threshold of 0 is lossless.
+//
+// Codec private data is a depth_delta_track_header_t; every block starts with a depth_delta_block_header_t.
+// All fields are little-endian.
+
+static const char depthDeltaTrack[] = "DEPTH_DELTA";
+static const char depthDeltaCodec[] = "S_K4A/DEPTH_DELTA";
+
+#pragma pack(push, 1)
+typedef struct
+{
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t keyframe_interval;
+    uint32_t threshold;
+} depth_delta_track_header_t;
+
+typedef struct
+{
+    uint8_t keyframe;
+    uint8_t reserved[3];
+    // Frames since the start of the take; keyframes have frame_index % keyframe_interval == 0.
+    uint32_t frame_index;
+    // Number of depth values following the mask (all pixels for a keyframe).
+    uint32_t value_count;
+} depth_delta_block_header_t;
+#pragma pack(pop)
+
+// Compares count pixels of current against reference, sets one mask bit per pixel whose absolute difference exceeds
+// threshold, appends the values of those pixels to packed and copies them into reference. mask must hold
+// (count + 7) / 8 bytes and packed count + 8 values, as the vector kernels store 8 values at a time. Returns the
+// number of packed values. Uses NEON or SSE where available.
+size_t depth_delta_compare_pack(const uint16_t *current,
+                                uint16_t *reference,
+                                size_t count,
+                                uint16_t threshold,
+                                uint8_t *mask,
+                                uint16_t *packed);
+
+// Portable version of depth_delta_compare_pack(), for comparison.
+size_t depth_delta_compare_pack_scalar(const uint16_t *current,
+                                       uint16_t *reference,
+                                       size_t count,
+                                       uint16_t threshold,
+                                       uint8_t *mask,
+                                       uint16_t *packed);
+
+class depth_delta_encoder
+{
+public:
+    depth_delta_encoder(uint32_t width, uint32_t height, uint32_t keyframe_interval, uint16_t threshold);
+
+    const depth_delta_track_header_t *track_header() const
+    {
+        return &m_header;
+    }
+
+    // Encodes the next frame of width * height pixels into block, replacing its contents.
+    void encode(const uint16_t *depth, std::vector<uint8_t> *block);
+
+private:
+    depth_delta_track_header_t m_header;
+    std::vector<uint16_t> m_reference;
+    std::vector<uint8_t> m_mask;
+    std::vector<uint16_t> m_packed;
+    uint32_t m_frame_index;
+};
+
+class depth_delta_decoder
+{
+public:
+    explicit depth_delta_decoder(const depth_delta_track_header_t *header);
+
+    // Applies a block and returns the reconstructed frame in depth (width * height pixels). Predicted frames need
+    // all blocks since their keyframe to have been decoded in order. Returns false for malformed blocks or a
+    // predicted frame without its keyframe.
+    bool decode(const uint8_t *block, size_t size, uint16_t *depth);
+
+private:
+    depth_delta_track_header_t m_header;
+    std::vector<uint16_t> m_reference;
+    bool m_have_keyframe;
+    uint32_t m_next_frame_index;
+};
+
+// Reads the DEPTH_DELTA track of a recording, with seeking to any timestamp. A seek decodes forward from the
+// keyframe at or before the target, so it costs at most keyframe_interval frames.
+class depth_delta_reader
+{
+public:
+    depth_delta_reader();
+    ~depth_delta_reader();
+
+    bool open(const char *path);
+    void close();
+
+    uint32_t width() const
+    {
+        return m_header.width;
+    }
+    uint32_t height() const
+    {
+        return m_header.height;
+    }
+
+    // Positions the reader so that next_frame() returns the first frame at or after device_timestamp_usec.
+    bool seek(uint64_t device_timestamp_usec);
+
+    // Decodes the next frame into depth (width * height pixels). Returns false at the end of the track or on error.
+    bool next_frame(uint16_t *depth, uint64_t *device_timestamp_usec);
+
+private:
+    bool decode_block(k4a_playback_data_block_t block, uint16_t *depth);
+
+    k4a_playback_t m_playback;
+    depth_delta_track_header_t m_header;
+    std::unique_ptr<depth_delta_decoder> m_decoder;
+    std::vector<uint16_t> m_scratch;
+    // Frame to return by the next call to next_frame(), already decoded by seek().
+    bool m_pending;
+    uint64_t m_pending_timestamp_usec;
+};
+
+// Encodes generated depth sequences (static background with sensor noise and a moving subject) in every depth mode
+// and prints the compression ratio, the encode time per frame with the SIMD and the scalar kernel, and the maximum
+// reconstruction error. Each sequence is also written to a temporary recording in the current directory and read
+// back with depth_delta_reader seeks to keyframes and to frames between them. Returns 0 if every sequence decoded
+// within the threshold and every seek returned the right frames.
+int run_depth_delta_benchmark(uint32_t keyframe_interval, uint16_t threshold);
+
+#endif /* DEPTH_DELTA_H */
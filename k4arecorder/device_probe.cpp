@@ -0,0 +1,248 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "device_probe.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <direct.h>
+#endif
+
+static const char *cacheMagic = "k4arecorder-device-cache";
+static const int cacheVersion = 1;
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::string device_cache_directory()
+{
+    const char *dir = getenv("K4ARECORDER_CACHE_DIR");
+    if (dir != NULL && *dir != '\0')
+    {
+        return dir;
+    }
+    dir = getenv("XDG_CACHE_HOME");
+    if (dir != NULL && *dir != '\0')
+    {
+        return std::string(dir) + "/k4arecorder";
+    }
+#if defined(_WIN32)
+    dir = getenv("LOCALAPPDATA");
+#else
+    dir = getenv("HOME");
+    if (dir != NULL && *dir != '\0')
+    {
+        return std::string(dir) + "/.cache/k4arecorder";
+    }
+#endif
+    return dir != NULL ? std::string(dir) + "/k4arecorder" : std::string("k4arecorder-cache");
+}
+
+static void make_directories(const std::string &path)
+{
+    for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1))
+    {
+        std::string prefix = path.substr(0, pos);
+#if defined(_WIN32)
+        _mkdir(prefix.c_str());
+#else
+        mkdir(prefix.c_str(), 0755);
+#endif
+        if (pos == std::string::npos)
+        {
+            break;
+        }
+    }
+}
+
+static std::string cache_file_path(const char *serial_number)
+{
+    return device_cache_directory() + "/" + serial_number + ".cache";
+}
+
+static bool versions_equal(const k4a_hardware_version_t *a, const k4a_hardware_version_t *b)
+{
+    const k4a_version_t *va[] = { &a->rgb, &a->depth, &a->depth_sensor, &a->audio };
+    const k4a_version_t *vb[] = { &b->rgb, &b->depth, &b->depth_sensor, &b->audio };
+    for (int i = 0; i < 4; i++)
+    {
+        if (va[i]->major != vb[i]->major || va[i]->minor != vb[i]->minor || va[i]->iteration != vb[i]->iteration)
+        {
+            return false;
+        }
+    }
+    return a->firmware_build == b->firmware_build;
+}
+
+// Cache file: one header line with the firmware versions and the calibration size, followed by the raw calibration.
+static bool read_cache(const char *serial_number,
+                       k4a_hardware_version_t *version,
+                       std::vector<uint8_t> *raw_calibration)
+{
+    std::ifstream file(cache_file_path(serial_number), std::ios::binary);
+    std::string header;
+    if (!file.is_open() || !std::getline(file, header))
+    {
+        return false;
+    }
+
+    std::istringstream fields(header);
+    std::string magic;
+    int file_version, firmware_build;
+    size_t calibration_size;
+    k4a_version_t *versions[] = { &version->rgb, &version->depth, &version->depth_sensor, &version->audio };
+    fields >> magic >> file_version;
+    for (k4a_version_t *v : versions)
+    {
+        fields >> v->major >> v->minor >> v->iteration;
+    }
+    fields >> firmware_build >> calibration_size;
+    if (!fields || magic != cacheMagic || file_version != cacheVersion || calibration_size == 0)
+    {
+        return false;
+    }
+    version->firmware_build = (k4a_firmware_build_t)firmware_build;
+
+    raw_calibration->resize(calibration_size);
+    file.read((char *)raw_calibration->data(), (std::streamsize)calibration_size);
+    return (size_t)file.gcount() == calibration_size;
+}
+
+static void write_cache(const char *serial_number,
+                        const k4a_hardware_version_t *version,
+                        const std::vector<uint8_t> &raw_calibration)
+{
+    make_directories(device_cache_directory());
+
+    // Write to a temporary file first so concurrent probes never see a partial entry.
+    std::string path = cache_file_path(serial_number);
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            return;
+        }
+        const k4a_version_t *versions[] = { &version->rgb, &version->depth, &version->depth_sensor, &version->audio };
+        file << cacheMagic << " " << cacheVersion;
+        for (const k4a_version_t *v : versions)
+        {
+            file << " " << v->major << " " << v->minor << " " << v->iteration;
+        }
+        file << " " << (int)version->firmware_build << " " << raw_calibration.size() << "\n";
+        file.write((const char *)raw_calibration.data(), (std::streamsize)raw_calibration.size());
+        if (!file)
+        {
+            return;
+        }
+    }
+    std::rename(temp_path.c_str(), path.c_str());
+}
+
+bool get_cached_raw_calibration(k4a_device_t device,
+                                const char *serial_number,
+                                const k4a_hardware_version_t *version,
+                                std::vector<uint8_t> *raw_calibration,
+                                bool *from_cache)
+{
+    k4a_hardware_version_t cached_version;
+    if (read_cache(serial_number, &cached_version, raw_calibration) && versions_equal(&cached_version, version))
+    {
+        *from_cache = true;
+        return true;
+    }
+
+    *from_cache = false;
+    size_t size = 0;
+    if (k4a_device_get_raw_calibration(device, NULL, &size) != K4A_BUFFER_RESULT_TOO_SMALL || size == 0)
+    {
+        return false;
+    }
+    raw_calibration->resize(size);
+    if (k4a_device_get_raw_calibration(device, raw_calibration->data(), &size) != K4A_BUFFER_RESULT_SUCCEEDED)
+    {
+        return false;
+    }
+    raw_calibration->resize(size);
+    write_cache(serial_number, version, *raw_calibration);
+    return true;
+}
+
+static void probe_device(device_probe_t *probe)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    k4a_device_t device;
+    auto step = std::chrono::steady_clock::now();
+    probe->opened = K4A_SUCCEEDED(k4a_device_open(probe->index, &device));
+    probe->open_ms = elapsed_ms(step);
+    if (!probe->opened)
+    {
+        probe->total_ms = elapsed_ms(start);
+        return;
+    }
+
+    step = std::chrono::steady_clock::now();
+    char serial_number_buffer[256];
+    size_t serial_number_buffer_size = sizeof(serial_number_buffer);
+    if (k4a_device_get_serialnum(device, serial_number_buffer, &serial_number_buffer_size) ==
+        K4A_BUFFER_RESULT_SUCCEEDED)
+    {
+        probe->serial_number = serial_number_buffer;
+    }
+    probe->serial_ms = elapsed_ms(step);
+
+    step = std::chrono::steady_clock::now();
+    probe->version_valid = K4A_SUCCEEDED(k4a_device_get_version(device, &probe->version));
+    probe->version_ms = elapsed_ms(step);
+
+    step = std::chrono::steady_clock::now();
+    if (probe->version_valid && !probe->serial_number.empty())
+    {
+        get_cached_raw_calibration(device,
+                                   probe->serial_number.c_str(),
+                                   &probe->version,
+                                   &probe->raw_calibration,
+                                   &probe->from_cache);
+    }
+    probe->calibration_ms = elapsed_ms(step);
+
+    step = std::chrono::steady_clock::now();
+    k4a_device_close(device);
+    probe->close_ms = elapsed_ms(step);
+    probe->total_ms = elapsed_ms(start);
+}
+
+std::vector<device_probe_t> probe_devices()
+{
+    uint32_t device_count = k4a_device_get_installed_count();
+    std::vector<device_probe_t> probes(device_count);
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < device_count; i++)
+    {
+        device_probe_t *probe = &probes[i];
+        probe->index = i;
+        probe->opened = false;
+        probe->version_valid = false;
+        memset(&probe->version, 0, sizeof(probe->version));
+        probe->from_cache = false;
+        probe->open_ms = probe->serial_ms = probe->version_ms = 0;
+        probe->calibration_ms = probe->close_ms = probe->total_ms = 0;
+        threads.emplace_back(probe_device, probe);
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    return probes;
+}
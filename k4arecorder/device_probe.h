@@ -0,0 +1,46 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef DEVICE_PROBE_H
+#define DEVICE_PROBE_H
+
+#include <k4a/k4a.h>
+
+#include <string>
+#include <vector>
+
+// What is known about one installed device, with the time each startup step took.
+typedef struct
+{
+    uint32_t index;
+    bool opened;
+    std::string serial_number;
+    bool version_valid;
+    k4a_hardware_version_t version;
+    std::vector<uint8_t> raw_calibration;
+    bool from_cache;
+    double open_ms;
+    double serial_ms;
+    double version_ms;
+    double calibration_ms;
+    double close_ms;
+    double total_ms;
+} device_probe_t;
+
+// Opens every installed device on its own thread and reads serial number, version and raw calibration. The
+// calibration comes from the per-serial cache when the cached firmware version still matches, and is written to the
+// cache otherwise.
+std::vector<device_probe_t> probe_devices();
+
+// Returns the raw calibration of an open device, from the cache when the firmware version matches. Returns false if
+// neither the cache nor the device provides one.
+bool get_cached_raw_calibration(k4a_device_t device,
+                                const char *serial_number,
+                                const k4a_hardware_version_t *version,
+                                std::vector<uint8_t> *raw_calibration,
+                                bool *from_cache);
+
+// Directory of the device cache: $K4ARECORDER_CACHE_DIR, $XDG_CACHE_HOME/k4arecorder or ~/.cache/k4arecorder.
+std::string device_cache_directory();
+
+#endif /* DEVICE_PROBE_H */
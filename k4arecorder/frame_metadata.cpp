@@ -0,0 +1,222 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "frame_metadata.h"
+
+#include <cstring>
+
+static const char frameMetadataMagic[8] = { 'K', '4', 'A', 'F', 'M', 'E', 'T', 'A' };
+static const uint32_t frameMetadataVersion = 1;
+static const size_t frameMetadataBlockRows = 256;
+static const size_t frameMetadataNameSize = 32;
+
+#pragma pack(push, 1)
+typedef struct
+{
+    char name[frameMetadataNameSize];
+    uint8_t type;
+    uint8_t width;
+    uint16_t reserved;
+} frame_metadata_column_header_t;
+#pragma pack(pop)
+
+// Calls visit(name, type, &column) for every column in file order. Values are stored in host byte order, which is
+// little-endian on every platform the recorder runs on.
+template<typename Table, typename Visitor> static void for_each_column(Table *table, Visitor visit)
+{
+    visit("color_device_timestamp_usec", FRAME_METADATA_TYPE_U64, &table->color_device_timestamp_usec);
+    visit("color_system_timestamp_nsec", FRAME_METADATA_TYPE_U64, &table->color_system_timestamp_nsec);
+    visit("depth_device_timestamp_usec", FRAME_METADATA_TYPE_U64, &table->depth_device_timestamp_usec);
+    visit("depth_system_timestamp_nsec", FRAME_METADATA_TYPE_U64, &table->depth_system_timestamp_nsec);
+    visit("exposure_usec", FRAME_METADATA_TYPE_U64, &table->exposure_usec);
+    visit("white_balance", FRAME_METADATA_TYPE_U32, &table->white_balance);
+    visit("iso_speed", FRAME_METADATA_TYPE_U32, &table->iso_speed);
+    visit("temperature_c", FRAME_METADATA_TYPE_F32, &table->temperature_c);
+    visit("flags", FRAME_METADATA_TYPE_U8, &table->flags);
+}
+
+std::string frame_metadata_path(const char *recording_filename)
+{
+    return std::string(recording_filename) + ".meta";
+}
+
+frame_metadata_writer::frame_metadata_writer() : m_file(NULL), m_failed(false) {}
+
+frame_metadata_writer::~frame_metadata_writer()
+{
+    close();
+}
+
+bool frame_metadata_writer::open(const char *path)
+{
+    m_file = fopen(path, "wb");
+    if (m_file == NULL)
+    {
+        return false;
+    }
+    m_failed = false;
+
+    uint32_t column_count = 0;
+    for_each_column(&m_rows, [&](const char *, frame_metadata_type_t, void *) { column_count++; });
+
+    fwrite(frameMetadataMagic, sizeof(frameMetadataMagic), 1, m_file);
+    fwrite(&frameMetadataVersion, sizeof(frameMetadataVersion), 1, m_file);
+    fwrite(&column_count, sizeof(column_count), 1, m_file);
+    for_each_column(&m_rows, [&](const char *name, frame_metadata_type_t type, auto *column) {
+        frame_metadata_column_header_t header;
+        memset(&header, 0, sizeof(header));
+        strncpy(header.name, name, sizeof(header.name) - 1);
+        header.type = (uint8_t)type;
+        header.width = (uint8_t)sizeof((*column)[0]);
+        fwrite(&header, sizeof(header), 1, m_file);
+    });
+    m_failed = ferror(m_file) != 0;
+    return !m_failed;
+}
+
+void frame_metadata_writer::append(k4a_capture_t capture)
+{
+    if (m_file == NULL)
+    {
+        return;
+    }
+
+    uint64_t color_device_timestamp = 0, color_system_timestamp = 0, exposure = 0;
+    uint32_t white_balance = 0, iso_speed = 0;
+    uint64_t depth_device_timestamp = 0, depth_system_timestamp = 0;
+    uint8_t flags = 0;
+
+    k4a_image_t image = k4a_capture_get_color_image(capture);
+    if (image != NULL)
+    {
+        flags |= frameMetadataHasColor;
+        color_device_timestamp = k4a_image_get_device_timestamp_usec(image);
+        color_system_timestamp = k4a_image_get_system_timestamp_nsec(image);
+        exposure = k4a_image_get_exposure_usec(image);
+        white_balance = k4a_image_get_white_balance(image);
+        iso_speed = k4a_image_get_iso_speed(image);
+        k4a_image_release(image);
+    }
+
+    // Passive IR mode has no depth image; its IR image carries the depth sensor timestamps.
+    image = k4a_capture_get_depth_image(capture);
+    if (image != NULL)
+    {
+        flags |= frameMetadataHasDepth;
+    }
+    else
+    {
+        image = k4a_capture_get_ir_image(capture);
+    }
+    if (image != NULL)
+    {
+        depth_device_timestamp = k4a_image_get_device_timestamp_usec(image);
+        depth_system_timestamp = k4a_image_get_system_timestamp_nsec(image);
+        k4a_image_release(image);
+    }
+    image = k4a_capture_get_ir_image(capture);
+    if (image != NULL)
+    {
+        flags |= frameMetadataHasIr;
+        k4a_image_release(image);
+    }
+
+    m_rows.color_device_timestamp_usec.push_back(color_device_timestamp);
+    m_rows.color_system_timestamp_nsec.push_back(color_system_timestamp);
+    m_rows.depth_device_timestamp_usec.push_back(depth_device_timestamp);
+    m_rows.depth_system_timestamp_nsec.push_back(depth_system_timestamp);
+    m_rows.exposure_usec.push_back(exposure);
+    m_rows.white_balance.push_back(white_balance);
+    m_rows.iso_speed.push_back(iso_speed);
+    m_rows.temperature_c.push_back(k4a_capture_get_temperature_c(capture));
+    m_rows.flags.push_back(flags);
+
+    if (m_rows.flags.size() >= frameMetadataBlockRows)
+    {
+        write_block();
+    }
+}
+
+void frame_metadata_writer::write_block()
+{
+    uint32_t row_count = (uint32_t)m_rows.flags.size();
+    if (row_count == 0)
+    {
+        return;
+    }
+
+    fwrite(&row_count, sizeof(row_count), 1, m_file);
+    for_each_column(&m_rows, [&](const char *, frame_metadata_type_t, auto *column) {
+        fwrite(column->data(), sizeof((*column)[0]), column->size(), m_file);
+        column->clear();
+    });
+    m_failed = m_failed || ferror(m_file) != 0;
+}
+
+bool frame_metadata_writer::close()
+{
+    if (m_file == NULL)
+    {
+        return !m_failed;
+    }
+    write_block();
+    m_failed = fclose(m_file) != 0 || m_failed;
+    m_file = NULL;
+    return !m_failed;
+}
+
+bool read_frame_metadata(const char *path, frame_metadata_table_t *table)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    char magic[sizeof(frameMetadataMagic)];
+    uint32_t version = 0, column_count = 0;
+    if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, frameMetadataMagic, sizeof(magic)) != 0 ||
+        fread(&version, sizeof(version), 1, file) != 1 || version != frameMetadataVersion ||
+        fread(&column_count, sizeof(column_count), 1, file) != 1)
+    {
+        fclose(file);
+        return false;
+    }
+
+    std::vector<frame_metadata_column_header_t> headers(column_count);
+    if (column_count > 0 && fread(headers.data(), sizeof(headers[0]), column_count, file) != column_count)
+    {
+        fclose(file);
+        return false;
+    }
+
+    bool ok = true;
+    std::vector<uint8_t> buffer;
+    uint32_t row_count;
+    while (ok && fread(&row_count, sizeof(row_count), 1, file) == 1)
+    {
+        for (const frame_metadata_column_header_t &header : headers)
+        {
+            size_t size = (size_t)row_count * header.width;
+            buffer.resize(size);
+            if (fread(buffer.data(), 1, size, file) != size)
+            {
+                ok = false;
+                break;
+            }
+
+            std::string name(header.name, strnlen(header.name, sizeof(header.name)));
+            for_each_column(table, [&](const char *column_name, frame_metadata_type_t type, auto *column) {
+                if (name == column_name && header.type == type && header.width == sizeof((*column)[0]))
+                {
+                    size_t offset = column->size();
+                    column->resize(offset + row_count);
+                    memcpy(column->data() + offset, buffer.data(), size);
+                }
+            });
+        }
+    }
+
+    fclose(file);
+    return ok;
+}
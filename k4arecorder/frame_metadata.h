@@ -0,0 +1,80 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef FRAME_METADATA_H
+#define FRAME_METADATA_H
+
+#include <k4a/k4a.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Per-frame capture metadata kept next to a recording, so exposure, white balance and sync analysis never has to
+// read the video data.
+//
+// File layout (little-endian):
+//   char     magic[8]            "K4AFMETA"
+//   uint32_t version             1
+//   uint32_t column_count
+//   column_count x { char name[32]; uint8_t type; uint8_t width; uint16_t reserved; }
+//   blocks until end of file:
+//     uint32_t row_count
+//     for each column: row_count fixed-width values
+//
+// Every column of a block is contiguous, so a reader loads one column of a whole session with a few large reads.
+// Missing images leave their columns zero; the "flags" column tells which images the capture had.
+
+typedef enum
+{
+    FRAME_METADATA_TYPE_U8 = 1,
+    FRAME_METADATA_TYPE_U32 = 4,
+    FRAME_METADATA_TYPE_U64 = 5,
+    FRAME_METADATA_TYPE_F32 = 6
+} frame_metadata_type_t;
+
+// Bits of the flags column.
+static const uint8_t frameMetadataHasColor = 0x1;
+static const uint8_t frameMetadataHasDepth = 0x2;
+static const uint8_t frameMetadataHasIr = 0x4;
+
+typedef struct
+{
+    std::vector<uint64_t> color_device_timestamp_usec;
+    std::vector<uint64_t> color_system_timestamp_nsec;
+    std::vector<uint64_t> depth_device_timestamp_usec;
+    std::vector<uint64_t> depth_system_timestamp_nsec;
+    std::vector<uint64_t> exposure_usec;
+    std::vector<uint32_t> white_balance;
+    std::vector<uint32_t> iso_speed;
+    std::vector<float> temperature_c;
+    std::vector<uint8_t> flags;
+} frame_metadata_table_t;
+
+// Buffers rows in memory and appends them to the file one block at a time.
+class frame_metadata_writer
+{
+public:
+    frame_metadata_writer();
+    ~frame_metadata_writer();
+
+    bool open(const char *path);
+    void append(k4a_capture_t capture);
+    // Writes the last partial block and closes the file. Returns false if any write failed.
+    bool close();
+
+private:
+    void write_block();
+
+    FILE *m_file;
+    bool m_failed;
+    frame_metadata_table_t m_rows;
+};
+
+// Loads a whole metadata file. Columns this version does not know are skipped, missing ones stay empty.
+bool read_frame_metadata(const char *path, frame_metadata_table_t *table);
+
+// Sidecar file name for a recording.
+std::string frame_metadata_path(const char *recording_filename);
+
+#endif /* FRAME_METADATA_H */
@@ -0,0 +1,112 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "ir_transform.h"
+#include "config.h"
+
+#include <cmath>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define IR_TRANSFORM_NEON
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define IR_TRANSFORM_SSE2
+#endif
+
+bool parse_ir_mode(const char *str, ir_mode_t *mode)
+{
+    static const ir_mode_t modes[] = { IR_MODE_FULL, IR_MODE_OFF, IR_MODE_HALF, IR_MODE_COMPRESSED };
+    for (ir_mode_t candidate : modes)
+    {
+        if (string_compare(str, ir_mode_name(candidate)) == 0)
+        {
+            *mode = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *ir_mode_name(ir_mode_t mode)
+{
+    switch (mode)
+    {
+    case IR_MODE_OFF:
+        return "off";
+    case IR_MODE_HALF:
+        return "half";
+    case IR_MODE_COMPRESSED:
+        return "compressed";
+    default:
+        return "full";
+    }
+}
+
+void ir_downsample_2x2(const uint16_t *src, int width, int height, size_t src_stride, uint16_t *dst)
+{
+    int out_width = width / 2;
+    for (int y = 0; y < height / 2; y++)
+    {
+        const uint16_t *row0 = (const uint16_t *)((const uint8_t *)src + (size_t)(y * 2) * src_stride);
+        const uint16_t *row1 = (const uint16_t *)((const uint8_t *)row0 + src_stride);
+        uint16_t *out = dst + (size_t)y * out_width;
+        int x = 0;
+
+#if defined(IR_TRANSFORM_NEON)
+        for (; x + 4 <= out_width; x += 4)
+        {
+            // Pairwise widening adds of both rows, then a rounding narrow by 4.
+            uint32x4_t sum = vaddq_u32(vpaddlq_u16(vld1q_u16(row0 + x * 2)), vpaddlq_u16(vld1q_u16(row1 + x * 2)));
+            vst1_u16(out + x, vrshrn_n_u32(sum, 2));
+        }
+#elif defined(IR_TRANSFORM_SSE2)
+        // SSE2 has no unsigned 16-bit pairwise add: bias to signed, add pairs with madd, and undo the bias.
+        const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+        const __m128i ones = _mm_set1_epi16(1);
+        const __m128i unbias_round = _mm_set1_epi32(4 * 32768 + 2);
+        const __m128i bias32 = _mm_set1_epi32(32768);
+        for (; x + 8 <= out_width; x += 8)
+        {
+            __m128i sums[2];
+            for (int half = 0; half < 2; half++)
+            {
+                __m128i top = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(row0 + x * 2 + half * 8)), bias16);
+                __m128i bottom = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(row1 + x * 2 + half * 8)), bias16);
+                __m128i sum = _mm_add_epi32(_mm_madd_epi16(top, ones), _mm_madd_epi16(bottom, ones));
+                sums[half] = _mm_sub_epi32(_mm_srai_epi32(_mm_add_epi32(sum, unbias_round), 2), bias32);
+            }
+            _mm_storeu_si128((__m128i *)(out + x), _mm_xor_si128(_mm_packs_epi32(sums[0], sums[1]), bias16));
+        }
+#endif
+
+        for (; x < out_width; x++)
+        {
+            uint32_t sum = (uint32_t)row0[x * 2] + row0[x * 2 + 1] + row1[x * 2] + row1[x * 2 + 1];
+            out[x] = (uint16_t)((sum + 2) / 4);
+        }
+    }
+}
+
+void ir_tone_map_8bit(const uint16_t *src, int width, int height, size_t src_stride, uint8_t *dst)
+{
+    static uint8_t table[irToneMapMax + 1];
+    static bool initialized = [] {
+        for (int value = 0; value <= irToneMapMax; value++)
+        {
+            table[value] = (uint8_t)std::lround(255.0 * std::sqrt((double)value / irToneMapMax));
+        }
+        return true;
+    }();
+    (void)initialized; // Unused
+
+    for (int y = 0; y < height; y++)
+    {
+        const uint16_t *row = (const uint16_t *)((const uint8_t *)src + (size_t)y * src_stride);
+        uint8_t *out = dst + (size_t)y * width;
+        for (int x = 0; x < width; x++)
+        {
+            out[x] = table[row[x] < irToneMapMax ? row[x] : irToneMapMax];
+        }
+    }
+}
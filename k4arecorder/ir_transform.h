@@ -0,0 +1,39 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef IR_TRANSFORM_H
+#define IR_TRANSFORM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// How the IR image of each capture is recorded.
+typedef enum
+{
+    // Full resolution in the built-in IR track (or IR_ROI when cropped).
+    IR_MODE_FULL,
+    // Not recorded; the built-in IR track stays declared but empty.
+    IR_MODE_OFF,
+    // 2x2 averaged 16-bit pixels in the IR_HALF track ("b16g").
+    IR_MODE_HALF,
+    // Tone mapped to 8 bits in the IR_8BIT track ("Y800"), see ir_tone_map_8bit().
+    IR_MODE_COMPRESSED
+} ir_mode_t;
+
+// Parses "full", "off", "half" or "compressed".
+bool parse_ir_mode(const char *str, ir_mode_t *mode);
+
+const char *ir_mode_name(ir_mode_t mode);
+
+// Averages each 2x2 block of a 16-bit image with rounding. width and height are those of the source, rounded down to
+// even; src_stride is in bytes. dst receives width / 2 tightly packed values per row. Uses NEON or SSE2 where
+// available.
+void ir_downsample_2x2(const uint16_t *src, int width, int height, size_t src_stride, uint16_t *dst);
+
+// Square-root tone curve to 8 bits: out = round(255 * sqrt(min(in, irToneMapMax) / irToneMapMax)), which keeps
+// detail in the dark range where most IR values are. dst receives width tightly packed bytes per row. Recordings
+// store the curve in the K4A_RECORDER_IR tag; the inverse is in = (out / 255)^2 * irToneMapMax.
+static const uint16_t irToneMapMax = 4095;
+void ir_tone_map_8bit(const uint16_t *src, int width, int height, size_t src_stride, uint8_t *dst);
+
+#endif /* IR_TRANSFORM_H */
@@ -5,6 +5,11 @@
 
 #include "cmdparser.h"
 #include "recorder.h"
+#include "config.h"
+#include "coordinator.h"
+#include "depth_delta.h"
+#include "soak.h"
+#include "device_probe.h"
 #include "assert.h"
 
 #if defined(_WIN32)
@@ -13,88 +18,112 @@
 
 #include <iostream>
 #include <atomic>
+#include <chrono>
 #include <ctime>
 #include <csignal>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
 #include <math.h>
 
-static time_t exiting_timestamp;
+static std::chrono::steady_clock::time_point exiting_time;
 
 static void signal_handler(int s)
 {
     (void)s; // Unused
 
-    if (!exiting)
+    // The first Ctrl-C only asks the recorder to stop. exiting may already be set by a timed recording that ended on
+    // its own and is still saving, without any Ctrl-C.
+    if (exiting_time == std::chrono::steady_clock::time_point())
     {
-        std::cout << "Stopping recording..." << std::endl;
-        exiting_timestamp = clock();
-        exiting = true;
+        if (!exiting)
+        {
+            std::cout << "Stopping recording..." << std::endl;
+            exiting = true;
+        }
+        exiting_time = std::chrono::steady_clock::now();
     }
-    // If Ctrl-C is received again after 1 second, force-stop the application since it's not responding.
-    else if (exiting_timestamp != 0 && clock() - exiting_timestamp > CLOCKS_PER_SEC)
+    // If Ctrl-C is received again after 1 second, force-stop the application since it's not responding. Wall time,
+    // as a recorder stuck waiting on the device or disk uses next to no CPU time.
+    else if (std::chrono::steady_clock::now() - exiting_time > std::chrono::seconds(1))
     {
         std::cout << "Forcing stop." << std::endl;
         exit(1);
     }
 }
 
-static int string_compare(const char *s1, const char *s2)
+static std::string format_version(const k4a_version_t *version)
 {
-    assert(s1 != NULL);
-    assert(s2 != NULL);
+    std::ostringstream str;
+    str << version->major << "." << version->minor << "." << version->iteration;
+    return str.str();
+}
 
-    while (tolower((unsigned char)*s1) == tolower((unsigned char)*s2))
+static std::string json_string(const std::string &value)
+{
+    std::string escaped = "\"";
+    for (char c : value)
     {
-        if (*s1 == '\0')
+        if (c == '"' || c == '\\')
         {
-            return 0;
+            escaped += '\\';
         }
-        s1++;
-        s2++;
+        escaped += c;
     }
-    // The return value shows the relations between s1 and s2.
-    // Return value   Description
-    //     < 0        s1 less than s2
-    //       0        s1 identical to s2
-    //     > 0        s1 greater than s2
-    return (int)tolower((unsigned char)*s1) - (int)tolower((unsigned char)*s2);
+    return escaped + "\"";
 }
 
-[[noreturn]] static void list_devices()
+[[noreturn]] static void list_devices(bool json)
 {
-    uint32_t device_count = k4a_device_get_installed_count();
-    if (device_count > 0)
+    auto start = std::chrono::steady_clock::now();
+    std::vector<device_probe_t> probes = probe_devices();
+    double probe_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (json)
     {
-        for (uint8_t i = 0; i < device_count; i++)
+        std::cout << "{\"probe_ms\": " << probe_ms << ", \"devices\": [";
+        for (size_t i = 0; i < probes.size(); i++)
         {
-            std::cout << "Index:" << (int)i;
-            k4a_device_t device;
-            if (K4A_SUCCEEDED(k4a_device_open(i, &device)))
+            const device_probe_t &probe = probes[i];
+            std::cout << (i > 0 ? ", " : "") << "{\"index\": " << probe.index
+                      << ", \"opened\": " << (probe.opened ? "true" : "false");
+            if (probe.opened)
             {
-                char serial_number_buffer[256];
-                size_t serial_number_buffer_size = sizeof(serial_number_buffer);
-                if (k4a_device_get_serialnum(device, serial_number_buffer, &serial_number_buffer_size) ==
-                    K4A_BUFFER_RESULT_SUCCEEDED)
-                {
-                    std::cout << "\tSerial:" << serial_number_buffer;
-                }
-                else
-                {
-                    std::cout << "\tSerial:ERROR";
-                }
+                std::cout << ", \"serial\": " << json_string(probe.serial_number);
+            }
+            if (probe.version_valid)
+            {
+                std::cout << ", \"color_firmware\": " << json_string(format_version(&probe.version.rgb))
+                          << ", \"depth_firmware\": " << json_string(format_version(&probe.version.depth));
+            }
+            std::cout << ", \"calibration_bytes\": " << probe.raw_calibration.size()
+                      << ", \"calibration_cached\": " << (probe.from_cache ? "true" : "false")
+                      << ", \"timing_ms\": {\"open\": " << probe.open_ms << ", \"serial\": " << probe.serial_ms
+                      << ", \"version\": " << probe.version_ms << ", \"calibration\": " << probe.calibration_ms
+                      << ", \"close\": " << probe.close_ms << ", \"total\": " << probe.total_ms << "}}";
+        }
+        std::cout << "]}" << std::endl;
+        exit(0);
+    }
 
-                k4a_hardware_version_t version_info;
-                if (K4A_SUCCEEDED(k4a_device_get_version(device, &version_info)))
+    if (probes.size() > 0)
+    {
+        for (const device_probe_t &probe : probes)
+        {
+            std::cout << "Index:" << probe.index;
+            if (probe.opened)
+            {
+                std::cout << "\tSerial:" << (probe.serial_number.empty() ? "ERROR" : probe.serial_number);
+                if (probe.version_valid)
                 {
-                    std::cout << "\tColor:" << version_info.rgb.major << "." << version_info.rgb.minor << "."
-                              << version_info.rgb.iteration;
-                    std::cout << "\tDepth:" << version_info.depth.major << "." << version_info.depth.minor << "."
-                              << version_info.depth.iteration;
+                    std::cout << "\tColor:" << format_version(&probe.version.rgb);
+                    std::cout << "\tDepth:" << format_version(&probe.version.depth);
                 }
-                k4a_device_close(device);
             }
             else
             {
-                std::cout << i << "\tDevice Open Failed";
+                std::cout << "\tDevice Open Failed";
             }
             std::cout << std::endl;
         }
@@ -108,25 +137,18 @@ static int string_compare(const char *s1, const char *s2)
 
 int main(int argc, char **argv)
 {
-    int device_index = 0;
-    int recording_length = -1;
-    k4a_image_format_t recording_color_format = K4A_IMAGE_FORMAT_COLOR_MJPG;
-    k4a_color_resolution_t recording_color_resolution = K4A_COLOR_RESOLUTION_1080P;
-    k4a_depth_mode_t recording_depth_mode = K4A_DEPTH_MODE_NFOV_UNBINNED;
-    k4a_fps_t recording_rate = K4A_FRAMES_PER_SECOND_30;
-    bool recording_rate_set = false;
-    bool recording_imu_enabled = false;
-    k4a_wired_sync_mode_t wired_sync_mode = K4A_WIRED_SYNC_MODE_STANDALONE;
-    int32_t depth_delay_off_color_usec = 0;
-    uint32_t subordinate_delay_off_master_usec = 0;
-    int absoluteExposureValue = defaultExposureAuto;
-    int gain = defaultGainAuto;
-    int brightness = defaultBrightness;  // Default brightness (example)
-    int contrast = defaultContrast;    // Default contrast (example)
-    int saturation = defaultSaturation;  // Default saturation (example)
-    int sharpness = defaultSharpness;   // Default sharpness (example)
-    int whitebalance = defaultWhitebalance;  // Default whitebalance (example)
-    char *recording_filename;
+    recorder_config_t config;
+    init_recorder_config(&config);
+    bool session = false;
+    bool list = false;
+    bool json = false;
+    bool benchmark_depth_delta = false;
+    const char *coordinate_nodes = NULL;
+    int soak_seconds = 0;
+    uint32_t soak_seed = std::random_device()();
+    soak_budget_t soak_budget;
+    init_soak_budget(&soak_budget);
+    char *recording_filename = NULL;
 
     CmdParser::OptionParser cmd_parser;
     cmd_parser.RegisterOption("-h|--help", "Prints this help", [&]() {
@@ -134,106 +156,114 @@ int main(int argc, char **argv)
         cmd_parser.PrintOptions();
         exit(0);
     });
-    cmd_parser.RegisterOption("--list", "List the currently connected K4A devices", list_devices);
+    cmd_parser.RegisterOption("--list", "List the currently connected K4A devices", [&]() { list = true; });
+    cmd_parser.RegisterOption("--json",
+                              "With --list, print the devices and the time each startup step took as JSON",
+                              [&]() { json = true; });
+    cmd_parser.RegisterOption("--config",
+                              "Load settings from a TOML config file. Options after --config override it.",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  if (load_config_file(args[0], &config) != 0)
+                                  {
+                                      throw std::runtime_error("Invalid config file");
+                                  }
+                              });
+    cmd_parser.RegisterOption("--session",
+                              "Keep the device open and record takes on commands read from stdin:\n"
+                              "arm <output.mkv> [seconds], start [<output.mkv> [seconds]], stop, status, quit",
+                              [&]() { session = true; });
+    cmd_parser.RegisterOption("--control-port",
+                              "With --session, also accept commands over TCP on this port (implies --session)",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "pipeline.control_port", args[0]);
+                                  session = true;
+                              });
+    cmd_parser.RegisterOption("--control-bind",
+                              "IPv4 address the control server listens on (default: 127.0.0.1). Give the address\n"
+                              "of the rig network interface to accept a coordinator on another machine.",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "pipeline.control_bind", args[0]);
+                              });
+    cmd_parser.RegisterOption("--output-dir",
+                              "With --session, directory that take file names are relative to (default: current\n"
+                              "directory). Absolute names and .. are refused.",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "pipeline.output_dir", args[0]);
+                              });
+    cmd_parser.RegisterOption("--coordinate",
+                              "Send a command to the session of every node in a comma-separated host:port list:\n"
+                              "status, arm <output.mkv> [seconds], start, take <output.mkv> [seconds], stop, quit\n"
+                              "{node} in the file name is replaced by the node's position in the list.",
+                              1,
+                              [&](const std::vector<char *> &args) { coordinate_nodes = args[0]; });
+    cmd_parser.RegisterOption("--synthetic",
+                              "Record generated frames in the configured modes instead of opening a device",
+                              [&]() { set_config_value(&config, "device.synthetic", "on"); });
+    cmd_parser.RegisterOption("--inject-faults",
+                              "With --synthetic, inject faults and print a soak report line on exit, for example\n"
+                              "slow_write=0.01,slow_write_ms=300,wait_failed=0.001,timestamp_jump=0.002,\n"
+                              "imu_reorder=0.02,stop_stall_ms=5000,seed=1 (see --soak)",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "device.inject_faults", args[0]);
+                              });
+    cmd_parser.RegisterOption("--soak",
+                              "Record the output file over and over for this many seconds with the synthetic\n"
+                              "source, random injected faults and random Ctrl-C, checking every run against the\n"
+                              "soak budget. The other options are passed on to each run.",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  soak_seconds = std::stoi(args[0]);
+                                  if (soak_seconds <= 0)
+                                  {
+                                      throw std::runtime_error("Soak duration must be positive");
+                                  }
+                              });
+    cmd_parser.RegisterOption("--soak-seed",
+                              "Seed of the soak run's random choices, to repeat a run (default: random)",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  soak_seed = (uint32_t)std::stoul(args[0]);
+                              });
+    cmd_parser.RegisterOption("--soak-budget",
+                              "Limits for each soak run: p99_write_ms (default 20), max_write_ms (500),\n"
+                              "rss_growth_mb (64), fd_growth (0) and live_images (0), e.g. p99_write_ms=10",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  if (!parse_soak_budget(args[0], &soak_budget))
+                                  {
+                                      throw std::runtime_error("Invalid soak budget");
+                                  }
+                              });
     cmd_parser.RegisterOption("--device",
                               "Specify the device index to use (default: 0)",
                               1,
                               [&](const std::vector<char *> &args) {
-                                  device_index = std::stoi(args[0]);
-                                  if (device_index < 0 || device_index > 255)
-                                      throw std::runtime_error("Device index must 0-255");
+                                  set_config_value(&config, "device.index", args[0]);
                               });
     cmd_parser.RegisterOption("-l|--record-length",
                               "Limit the recording to N seconds (default: infinite)",
                               1,
                               [&](const std::vector<char *> &args) {
-                                  recording_length = std::stoi(args[0]);
-                                  if (recording_length < 0)
-                                      throw std::runtime_error("Recording length must be positive");
+                                  set_config_value(&config, "pipeline.record_length", args[0]);
                               });
     cmd_parser.RegisterOption("-c|--color-mode",
                               "Set the color sensor mode (default: 1080p), Available options:\n"
                               "2160p, 1536p, 1440p, 1080p, 720p, 720p_NV12, 720p_YUY2, OFF",
                               1,
                               [&](const std::vector<char *> &args) {
-                                 if (string_compare(args[0], "2160p") == 0)
-                                  {
-                                      recording_color_resolution = K4A_COLOR_RESOLUTION_2160P;
-                                  }
-                                  else if (string_compare(args[0], "1536p") == 0)
-                                  {
-                                      recording_color_resolution = K4A_COLOR_RESOLUTION_1536P;
-                                  }
-                                  else if (string_compare(args[0], "1440p") == 0)
-                                  {
-                                      recording_color_resolution = K4A_COLOR_RESOLUTION_1440P;
-                                  }
-                                  else if (string_compare(args[0], "1080p") == 0)
-                                  {
-                                      recording_color_resolution = K4A_COLOR_RESOLUTION_1080P;
-                                  }
-                                  else if (string_compare(args[0], "720p") == 0)
-                                  {
-                                      recording_color_resolution = K4A_COLOR_RESOLUTION_720P;
-                                  }
-                                  else if (string_compare(args[0], "720p_NV12") == 0)
-                                  {
-                                      recording_color_format = K4A_IMAGE_FORMAT_COLOR_NV12;
-                                      recording_color_resolution = K4A_COLOR_RESOLUTION_720P;
-                                  }
-                                  else if (string_compare(args[0], "720p_YUY2") == 0)
-                                  {
-                                      recording_color_format = K4A_IMAGE_FORMAT_COLOR_YUY2;
-                                      recording_color_resolution = K4A_COLOR_RESOLUTION_720P;
-                                  }
-                                  else if (string_compare(args[0], "off") == 0)
-                                  {
-                                      recording_color_resolution = K4A_COLOR_RESOLUTION_OFF;
-                                  }
-                                  else
-                                  {
-                                      recording_color_resolution = K4A_COLOR_RESOLUTION_OFF;
-
-                                      std::ostringstream str;
-                                      str << "Unknown color mode specified: " << args[0];
-                                      throw std::runtime_error(str.str());
-                                  }
+                                  set_config_value(&config, "device.color_mode", args[0]);
                               });
     cmd_parser.RegisterOption("-d|--depth-mode",
                               "Set the depth sensor mode (default: NFOV_UNBINNED), Available options:\n"
                               "NFOV_2X2BINNED, NFOV_UNBINNED, WFOV_2X2BINNED, WFOV_UNBINNED, PASSIVE_IR, OFF",
                               1,
                               [&](const std::vector<char *> &args) {
-                                  if (string_compare(args[0], "NFOV_2X2BINNED") == 0)
-                                  {
-                                      recording_depth_mode = K4A_DEPTH_MODE_NFOV_2X2BINNED;
-                                  }
-                                  else if (string_compare(args[0], "NFOV_UNBINNED") == 0)
-                                  {
-                                      recording_depth_mode = K4A_DEPTH_MODE_NFOV_UNBINNED;
-                                  }
-                                  else if (string_compare(args[0], "WFOV_2X2BINNED") == 0)
-                                  {
-                                      recording_depth_mode = K4A_DEPTH_MODE_WFOV_2X2BINNED;
-                                  }
-                                  else if (string_compare(args[0], "WFOV_UNBINNED") == 0)
-                                  {
-                                      recording_depth_mode = K4A_DEPTH_MODE_WFOV_UNBINNED;
-                                  }
-                                  else if (string_compare(args[0], "PASSIVE_IR") == 0)
-                                  {
-                                      recording_depth_mode = K4A_DEPTH_MODE_PASSIVE_IR;
-                                  }
-                                  else if (string_compare(args[0], "off") == 0)
-                                  {
-                                      recording_depth_mode = K4A_DEPTH_MODE_OFF;
-                                  }
-                                  else
-                                  {
-                                      std::ostringstream str;
-                                      str << "Unknown depth mode specified: " << args[0];
-                                      throw std::runtime_error(str.str());
-                                  }
+                                  set_config_value(&config, "device.depth_mode", args[0]);
                               });
     cmd_parser.RegisterOption("--depth-delay",
                               "Set the time offset between color and depth frames in microseconds (default: 0)\n"
@@ -241,7 +271,7 @@ int main(int argc, char **argv)
                               "The delay must be less than 1 frame period.",
                               1,
                               [&](const std::vector<char *> &args) {
-                                  depth_delay_off_color_usec = std::stoi(args[0]);
+                                  set_config_value(&config, "device.depth_delay", args[0]);
                               });
     cmd_parser.RegisterOption("-r|--rate",
                               "Set the camera frame rate in Frames per Second\n"
@@ -249,185 +279,146 @@ int main(int argc, char **argv)
                               "Available options: 30, 25,15, 5",
                               1,
                               [&](const std::vector<char *> &args) {
-                                  recording_rate_set = true;
-                                  if (string_compare(args[0], "30") == 0)
-                                  {
-                                      recording_rate = K4A_FRAMES_PER_SECOND_30;
-                                  }
-                                  else if (string_compare(args[0], "25") == 0)
-                                  {
-                                      recording_rate = K4A_FRAMES_PER_SECOND_25;
-                                  }
-                                  else if (string_compare(args[0], "15") == 0)
-                                  {
-                                      recording_rate = K4A_FRAMES_PER_SECOND_15;
-                                  }
-                                  else if (string_compare(args[0], "5") == 0)
-                                  {
-                                      recording_rate = K4A_FRAMES_PER_SECOND_5;
-                                  }
-                                  else
-                                  {
-                                      std::ostringstream str;
-                                      str << "Unknown frame rate specified: " << args[0];
-                                      throw std::runtime_error(str.str());
-                                  }
+                                  set_config_value(&config, "device.rate", args[0]);
                               });
     cmd_parser.RegisterOption("--imu",
                               "Set the IMU recording mode (ON, OFF, default: ON)",
                               1,
                               [&](const std::vector<char *> &args) {
-                                  if (string_compare(args[0], "on") == 0)
-                                  {
-                                      recording_imu_enabled = true;
-                                  }
-                                  else if (string_compare(args[0], "off") == 0)
-                                  {
-                                      recording_imu_enabled = false;
-                                  }
-                                  else
-                                  {
-                                      std::ostringstream str;
-                                      str << "Unknown imu mode specified: " << args[0];
-                                      throw std::runtime_error(str.str());
-                                  }
+                                  set_config_value(&config, "device.imu", args[0]);
                               });
     cmd_parser.RegisterOption("--external-sync",
                               "Set the external sync mode (Master, Subordinate, Standalone default: Standalone)",
                               1,
                               [&](const std::vector<char *> &args) {
-                                  if (string_compare(args[0], "master") == 0)
-                                  {
-                                      wired_sync_mode = K4A_WIRED_SYNC_MODE_MASTER;
-                                  }
-                                  else if (string_compare(args[0], "subordinate") == 0 ||
-                                           string_compare(args[0], "sub") == 0)
-                                  {
-                                      wired_sync_mode = K4A_WIRED_SYNC_MODE_SUBORDINATE;
-                                  }
-                                  else if (string_compare(args[0], "standalone") == 0)
-                                  {
-                                      wired_sync_mode = K4A_WIRED_SYNC_MODE_STANDALONE;
-                                  }
-                                  else
-                                  {
-                                      std::ostringstream str;
-                                      str << "Unknown external sync mode specified: " << args[0];
-                                      throw std::runtime_error(str.str());
-                                  }
+                                  set_config_value(&config, "device.external_sync", args[0]);
                               });
     cmd_parser.RegisterOption("--sync-delay",
                               "Set the external sync delay off the master camera in microseconds (default: 0)\n"
                               "This setting is only valid if the camera is in Subordinate mode.",
                               1,
                               [&](const std::vector<char *> &args) {
-                                  int delay = std::stoi(args[0]);
-                                  if (delay < 0)
-                                  {
-                                      throw std::runtime_error("External sync delay must be positive.");
-                                  }
-                                  subordinate_delay_off_master_usec = (uint32_t)delay;
+                                  set_config_value(&config, "device.sync_delay", args[0]);
                               });
     cmd_parser.RegisterOption("-e|--exposure-control",
                               "Set manual exposure value from 100 us to 409500us for the RGB camera (default: \n"
                               "auto exposure)).",
                               1,
                               [&](const std::vector<char *> &args) {
-                                  int exposureValue = std::stoi(args[0]);
-                                  if (exposureValue >= 100 && exposureValue <= 409500)
-                                  {
-                                      absoluteExposureValue = exposureValue;
-                                  }
-                                  else
-                                  {
-                                      throw std::runtime_error("Exposure value range is 100 to 409500");
-                                  }
+                                  set_config_value(&config, "color.exposure", args[0]);
                               });
     cmd_parser.RegisterOption("-b|--brightness",
-                          "Set manual brightness value (default: auto) between 0-100",
-                          1,
-                          [&](const std::vector<char *> &args) {
-                              int brightnessSetting = std::stoi(args[0]);
-                              if (brightnessSetting >= 0 && brightnessSetting <= 100)
-                              {
-                                  brightness = brightnessSetting;
-                              }
-                              else
-                              {
-                                  throw std::runtime_error("Brightness value must be between 0 and 100.");
-                              }
-                          });
-
+                              "Set manual brightness value (default: auto) between 0-100",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "color.brightness", args[0]);
+                              });
     cmd_parser.RegisterOption("-t|--contrast",
-                          "Set manual contrast value (default: auto) between 0-100",
-                          1,
-                          [&](const std::vector<char *> &args) {
-                              int contrastSetting = std::stoi(args[0]);
-                              if (contrastSetting >= 0 && contrastSetting <= 100)
-                              {
-                                  contrast = contrastSetting;
-                              }
-                              else
-                              {
-                                  throw std::runtime_error("Contrast value must be between 0 and 100.");
-                              }
-                          });
-
+                              "Set manual contrast value (default: auto) between 0-100",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "color.contrast", args[0]);
+                              });
     cmd_parser.RegisterOption("-s|--saturation",
-                          "Set manual saturation value (default: auto) between 0-100",
-                          1,
-                          [&](const std::vector<char *> &args) {
-                              int saturationSetting = std::stoi(args[0]);
-                              if (saturationSetting >= 0 && saturationSetting <= 100)
-                              {
-                                  saturation = saturationSetting;
-                              }
-                              else
-                              {
-                                  throw std::runtime_error("Saturation value must be between 0 and 100.");
-                              }
-                          });
-
+                              "Set manual saturation value (default: auto) between 0-100",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "color.saturation", args[0]);
+                              });
     cmd_parser.RegisterOption("-p|--sharpness",
-                          "Set manual sharpness value (default: auto) between 0-100",
-                          1,
-                          [&](const std::vector<char *> &args) {
-                              int sharpnessSetting = std::stoi(args[0]);
-                              if (sharpnessSetting >= 0 && sharpnessSetting <= 100)
-                              {
-                                  sharpness = sharpnessSetting;
-                              }
-                              else
-                              {
-                                  throw std::runtime_error("Sharpness value must be between 0 and 100.");
-                              }
-                          });
-
+                              "Set manual sharpness value (default: auto) between 0-100",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "color.sharpness", args[0]);
+                              });
     cmd_parser.RegisterOption("-w|--whitebalance",
-                          "Set manual white balance value (default: auto) between 2000-11000",
-                          1,
-                          [&](const std::vector<char *> &args) {
-                              int whitebalanceSetting = std::stoi(args[0]);
-                              if (whitebalanceSetting >= 2000 && whitebalanceSetting <= 11000)
-                              {
-                                  whitebalance = whitebalanceSetting;
-                              }
-                              else
-                              {
-                                  throw std::runtime_error("White balance value must be between 2800 and 6500K.");
-                              }
-                          });
-
+                              "Set manual white balance value (default: auto) between 2000-11000",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "color.whitebalance", args[0]);
+                              });
     cmd_parser.RegisterOption("-g|--gain",
                               "Set cameras manual gain. The valid range is 1 to 255. (default: auto)",
                               1,
                               [&](const std::vector<char *> &args) {
-                                  int gainSetting = std::stoi(args[0]);
-                                  if (gainSetting < 1 || gainSetting > 255)
-                                  {
-                                      throw std::runtime_error("Gain value must be between 0 and 255.");
-                                  }
-                                  gain = gainSetting;
+                                  set_config_value(&config, "color.gain", args[0]);
+                              });
+    cmd_parser.RegisterOption("--roi-depth",
+                              "Crop depth and IR to a pixel rectangle of the depth image: x,y,width,height\n"
+                              "Cropped images are written to the DEPTH_ROI and IR_ROI tracks.",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "pipeline.roi_depth", args[0]);
+                              });
+    cmd_parser.RegisterOption("--roi-color",
+                              "Crop color to a pixel rectangle of the color image: x,y,width,height\n"
+                              "Cropped images are written to the COLOR_ROI track.",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "pipeline.roi_color", args[0]);
+                              });
+    cmd_parser.RegisterOption("--roi-stage",
+                              "Crop to a stage bounding box in millimeters in the depth camera frame:\n"
+                              "xmin,ymin,zmin,xmax,ymax,zmax. The box is projected through the device calibration\n"
+                              "for every camera without an explicit --roi-depth/--roi-color rectangle.",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "pipeline.roi_stage", args[0]);
+                              });
+    cmd_parser.RegisterOption("--ir",
+                              "Set how the IR stream is recorded (FULL, OFF, HALF, COMPRESSED, default: FULL).\n"
+                              "HALF stores 2x2 averaged frames in the IR_HALF track, COMPRESSED 8-bit tone mapped\n"
+                              "frames in the IR_8BIT track.",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "pipeline.ir", args[0]);
+                              });
+    cmd_parser.RegisterOption("--depth-delta",
+                              "Store depth as keyframes plus changed pixels in the DEPTH_DELTA track instead of\n"
+                              "full frames in the DEPTH track (ON, OFF, default: OFF)",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "pipeline.depth_delta", args[0]);
+                              });
+    cmd_parser.RegisterOption("--depth-delta-keyframe",
+                              "With --depth-delta, store a full depth frame every N frames (default: 30)",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "pipeline.depth_delta_keyframe", args[0]);
+                              });
+    cmd_parser.RegisterOption("--depth-delta-threshold",
+                              "With --depth-delta, keep changes up to N mm out of predicted frames (default: 4,\n"
+                              "0 is lossless)",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "pipeline.depth_delta_threshold", args[0]);
+                              });
+    cmd_parser.RegisterOption("--benchmark-depth-delta",
+                              "Print the depth delta compression ratio and encode time for every depth mode on\n"
+                              "generated frames, using the keyframe and threshold settings",
+                              [&]() { benchmark_depth_delta = true; });
+    cmd_parser.RegisterOption("--storage-check",
+                              "Before a take, compare the estimated data rate and length with a write speed probe\n"
+                              "and the free space of the target filesystem (REFUSE, WARN, OFF, default: WARN).\n"
+                              "Unless OFF, a take also stops cleanly before the free space drops below\n"
+                              "--min-free-mb.",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "pipeline.storage_check", args[0]);
+                              });
+    cmd_parser.RegisterOption("--min-free-mb",
+                              "Free space in MB to keep on the recording disk, at least 1 (default: 256). At high\n"
+                              "data rates a take stops earlier, leaving room for 3 s of writes.",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "pipeline.min_free_mb", args[0]);
+                              });
+    cmd_parser.RegisterOption("--frame-metadata",
+                              "Write per-frame timestamps, exposure, white balance, ISO and temperature to a\n"
+                              "columnar <output>.meta sidecar file (ON, OFF, default: ON)",
+                              1,
+                              [&](const std::vector<char *> &args) {
+                                  set_config_value(&config, "pipeline.frame_metadata", args[0]);
                               });
 
     int args_left = 0;
@@ -440,35 +431,49 @@ int main(int argc, char **argv)
         std::cerr << e.option() << ": " << e.what() << std::endl;
         return 1;
     }
-    if (args_left == 1)
+    if (list)
+    {
+        list_devices(json);
+    }
+    if (benchmark_depth_delta)
+    {
+        return run_depth_delta_benchmark(config.depth_delta_keyframe_interval, config.depth_delta_threshold);
+    }
+    if (coordinate_nodes != NULL)
+    {
+        return run_coordinator(coordinate_nodes, std::vector<std::string>(argv + argc - args_left, argv + argc));
+    }
+    if (args_left == 1 && !session)
     {
         recording_filename = argv[argc - 1];
     }
-    else
+    else if (args_left != 0 || !session)
     {
         std::cout << "k4arecorder [options] output.mkv" << std::endl << std::endl;
         cmd_parser.PrintOptions();
         return 0;
     }
 
-    if (recording_rate == K4A_FRAMES_PER_SECOND_30 && (recording_depth_mode == K4A_DEPTH_MODE_WFOV_UNBINNED ||
-                                                       recording_color_resolution == K4A_COLOR_RESOLUTION_3072P))
+    if (validate_recorder_config(&config) != 0)
     {
-        if (!recording_rate_set)
-        {
-            // Default to max supported frame rate
-            recording_rate = K4A_FRAMES_PER_SECOND_15;
-        }
-        else
-        {
-            std::cerr << "Error: 30 Frames per second is not supported by this camera mode." << std::endl;
-            return 1;
-        }
+        return 1;
     }
-    if (subordinate_delay_off_master_usec > 0 && wired_sync_mode != K4A_WIRED_SYNC_MODE_SUBORDINATE)
+
+    if (soak_seconds > 0 && recording_filename != NULL)
     {
-        std::cerr << "--sync-delay is only valid if --external-sync is set to Subordinate." << std::endl;
-        return 1;
+        // Each run gets the same options, minus the soak's own.
+        std::vector<std::string> recorder_args;
+        for (int i = 1; i < argc - 1; i++)
+        {
+            std::string arg = argv[i];
+            if (arg == "--soak" || arg == "--soak-seed" || arg == "--soak-budget")
+            {
+                i++;
+                continue;
+            }
+            recorder_args.push_back(arg);
+        }
+        return run_soak(argv[0], recorder_args, recording_filename, (uint32_t)soak_seconds, soak_seed, &soak_budget);
     }
 
 #if defined(_WIN32)
@@ -490,25 +495,9 @@ int main(int argc, char **argv)
     sigaction(SIGINT, &act, 0);
 #endif
 
-    k4a_device_configuration_t device_config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
-    device_config.color_format = recording_color_format;
-    device_config.color_resolution = recording_color_resolution;
-    device_config.depth_mode = recording_depth_mode;
-    device_config.camera_fps = recording_rate;
-    device_config.wired_sync_mode = wired_sync_mode;
-    device_config.depth_delay_off_color_usec = depth_delay_off_color_usec;
-    device_config.subordinate_delay_off_master_usec = subordinate_delay_off_master_usec;
-
-    return do_recording((uint8_t)device_index,
-                        recording_filename,
-                        recording_length,
-                        &device_config,
-                        recording_imu_enabled,
-                        absoluteExposureValue,
-			whitebalance,
-                        gain,
-                        brightness,
-                        contrast,
-			saturation,
-			sharpness);
+    if (session)
+    {
+        return do_session(&config);
+    }
+    return do_recording(&config, recording_filename);
 }
@@ -2,16 +2,30 @@
 // Licensed under the MIT License.
 
 #include "recorder.h"
-#include <ctime>
+#include "capture_source.h"
+#include "capture_writer.h"
+#include "control_server.h"
+#include "device_probe.h"
+#include "frame_metadata.h"
+#include "session.h"
+#include "soak.h"
+#include "storage.h"
+#include <chrono>
+#include <cstdio>
 #include <atomic>
+#include <iomanip>
 #include <iostream>
 #include <algorithm>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 #include <k4a/k4a.h>
 #include <k4arecord/record.h>
 
 
-inline static uint32_t k4a_convert_fps_to_uint(k4a_fps_t fps)
+uint32_t k4a_convert_fps_to_uint(k4a_fps_t fps)
 {
     uint32_t fps_int;
     switch (fps)
@@ -32,6 +46,65 @@ inline static uint32_t k4a_convert_fps_to_uint(k4a_fps_t fps)
     return fps_int;
 }
 
+bool get_color_resolution_size(k4a_color_resolution_t resolution, int *width, int *height)
+{
+    switch (resolution)
+    {
+    case K4A_COLOR_RESOLUTION_720P:
+        *width = 1280;
+        *height = 720;
+        return true;
+    case K4A_COLOR_RESOLUTION_1080P:
+        *width = 1920;
+        *height = 1080;
+        return true;
+    case K4A_COLOR_RESOLUTION_1440P:
+        *width = 2560;
+        *height = 1440;
+        return true;
+    case K4A_COLOR_RESOLUTION_1536P:
+        *width = 2048;
+        *height = 1536;
+        return true;
+    case K4A_COLOR_RESOLUTION_2160P:
+        *width = 3840;
+        *height = 2160;
+        return true;
+    case K4A_COLOR_RESOLUTION_3072P:
+        *width = 4096;
+        *height = 3072;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool get_depth_mode_size(k4a_depth_mode_t depth_mode, int *width, int *height)
+{
+    switch (depth_mode)
+    {
+    case K4A_DEPTH_MODE_NFOV_2X2BINNED:
+        *width = 320;
+        *height = 288;
+        return true;
+    case K4A_DEPTH_MODE_NFOV_UNBINNED:
+        *width = 640;
+        *height = 576;
+        return true;
+    case K4A_DEPTH_MODE_WFOV_2X2BINNED:
+        *width = 512;
+        *height = 512;
+        return true;
+    case K4A_DEPTH_MODE_WFOV_UNBINNED:
+    case K4A_DEPTH_MODE_PASSIVE_IR:
+        *width = 1024;
+        *height = 1024;
+        return true;
+    default:
+        return false;
+    }
+}
+
 // call k4a_device_close on every failed CHECK
 #define CHECK(x, device)                                                                                               \
     {                                                                                                                  \
@@ -46,29 +119,150 @@ inline static uint32_t k4a_convert_fps_to_uint(k4a_fps_t fps)
 
 std::atomic_bool exiting(false);
 
-int do_recording(uint8_t device_index,
-                 char *recording_filename,
-                 int recording_length,
-                 k4a_device_configuration_t *device_config,
-                 bool record_imu,
-                 int32_t absoluteExposureValue,
-                 int32_t whitebalance,
-                 int32_t gain,
-                 int32_t brightness,
-                 int32_t contrast,
-                 int32_t saturation,
-                 int32_t sharpness)
+// Frame rate and dropped frames of the incoming stream, from the device timestamps of the captures.
+typedef struct
+{
+    uint64_t last_device_timestamp_usec;
+    std::chrono::steady_clock::time_point fps_window_start;
+    uint32_t fps_window_frames;
+    double fps;
+} stream_stats_t;
+
+typedef struct
+{
+    capture_source *source;
+    // The source again when it injects faults, otherwise NULL.
+    faulty_capture_source *faults;
+    const recorder_config_t *config;
+    uint32_t camera_fps;
+    k4a_calibration_t calibration;
+    bool calibration_valid;
+    // Set once the cameras (and the IMU, if recorded) have been started.
+    bool streaming;
+    stream_stats_t stats;
+} recorder_context_t;
+
+typedef struct
+{
+    k4a_color_control_command_t command;
+    k4a_color_control_mode_t mode;
+    int32_t value;
+    const char *name;
+} color_control_request_t;
+
+// Applies the requested color controls, skipping the ones the device already has. Exposure is always requested
+// (auto unless set); the other controls only when they differ from their defaults.
+static void apply_color_controls(k4a_device_t device, const color_control_settings_t *controls)
+{
+    std::vector<color_control_request_t> requests;
+    if (controls->absoluteExposureValue != defaultExposureAuto)
+    {
+        requests.push_back({ K4A_COLOR_CONTROL_EXPOSURE_TIME_ABSOLUTE,
+                             K4A_COLOR_CONTROL_MODE_MANUAL,
+                             controls->absoluteExposureValue,
+                             "manual exposure" });
+    }
+    else
+    {
+        requests.push_back(
+            { K4A_COLOR_CONTROL_EXPOSURE_TIME_ABSOLUTE, K4A_COLOR_CONTROL_MODE_AUTO, 0, "auto exposure" });
+    }
+    if (controls->gain != defaultGainAuto)
+    {
+        requests.push_back({ K4A_COLOR_CONTROL_GAIN, K4A_COLOR_CONTROL_MODE_MANUAL, controls->gain, "manual gain" });
+    }
+    if (controls->brightness != defaultBrightness)
+    {
+        requests.push_back(
+            { K4A_COLOR_CONTROL_BRIGHTNESS, K4A_COLOR_CONTROL_MODE_MANUAL, controls->brightness, "manual brightness" });
+    }
+    if (controls->contrast != defaultContrast)
+    {
+        requests.push_back(
+            { K4A_COLOR_CONTROL_CONTRAST, K4A_COLOR_CONTROL_MODE_MANUAL, controls->contrast, "manual contrast" });
+    }
+    if (controls->saturation != defaultSaturation)
+    {
+        requests.push_back(
+            { K4A_COLOR_CONTROL_SATURATION, K4A_COLOR_CONTROL_MODE_MANUAL, controls->saturation, "manual saturation" });
+    }
+    if (controls->sharpness != defaultSharpness)
+    {
+        requests.push_back(
+            { K4A_COLOR_CONTROL_SHARPNESS, K4A_COLOR_CONTROL_MODE_MANUAL, controls->sharpness, "manual sharpness" });
+    }
+    if (controls->whitebalance != defaultWhitebalance)
+    {
+        requests.push_back({ K4A_COLOR_CONTROL_WHITEBALANCE,
+                             K4A_COLOR_CONTROL_MODE_MANUAL,
+                             controls->whitebalance,
+                             "manual whitebalance" });
+    }
+
+    for (const color_control_request_t &request : requests)
+    {
+        k4a_color_control_mode_t current_mode;
+        int32_t current_value;
+        if (K4A_SUCCEEDED(k4a_device_get_color_control(device, request.command, &current_mode, &current_value)) &&
+            current_mode == request.mode &&
+            (request.mode == K4A_COLOR_CONTROL_MODE_AUTO || current_value == request.value))
+        {
+            continue;
+        }
+
+        if (K4A_FAILED(k4a_device_set_color_control(device, request.command, request.mode, request.value)))
+        {
+            std::cerr << "Runtime error: k4a_device_set_color_control() for " << request.name << " failed "
+                      << std::endl;
+        }
+    }
+}
+
 
+// Opens the device (or the synthetic source), prints its identity and applies the color controls.
+static int open_device(const recorder_config_t *config, recorder_context_t *context)
 {
+    const k4a_device_configuration_t *device_config = &config->device_config;
+    uint32_t camera_fps = k4a_convert_fps_to_uint(device_config->camera_fps);
+    if (camera_fps <= 0 || (device_config->color_resolution == K4A_COLOR_RESOLUTION_OFF &&
+                            device_config->depth_mode == K4A_DEPTH_MODE_OFF))
+    {
+        std::cerr << "Either the color or depth modes must be enabled to record." << std::endl;
+        return 1;
+    }
+
+    context->config = config;
+    context->faults = NULL;
+    context->camera_fps = camera_fps;
+    context->calibration_valid = false;
+    context->streaming = false;
+    context->stats = stream_stats_t();
+
+    if (config->synthetic)
+    {
+        std::cout << "Using the synthetic capture source" << std::endl;
+        if (config->roi.stage_box_enabled)
+        {
+            std::cerr << "Runtime error: the synthetic source has no calibration, stage box ignored" << std::endl;
+        }
+        context->source = new synthetic_capture_source();
+        if (config->faults.enabled)
+        {
+            context->faults = new faulty_capture_source(context->source, &config->faults);
+            context->source = context->faults;
+        }
+        return 0;
+    }
+
     const uint32_t installed_devices = k4a_device_get_installed_count();
-    if (device_index >= installed_devices)
+    if (config->device_index >= installed_devices)
     {
         std::cerr << "Device not found." << std::endl;
         return 1;
     }
 
     k4a_device_t device;
-    if (K4A_FAILED(k4a_device_open(device_index, &device)))
+    if (K4A_FAILED(k4a_device_open(config->device_index, &device)))
     {
         std::cerr << "Runtime error: k4a_device_open() failed " << std::endl;
     }
@@ -90,120 +284,82 @@ int do_recording(uint8_t device_index,
               << "; A: " << version_info.audio.major << "." << version_info.audio.minor << "."
               << version_info.audio.iteration << std::endl;
 
-    uint32_t camera_fps = k4a_convert_fps_to_uint(device_config->camera_fps);
+    apply_color_controls(device, &config->color_controls);
 
-    if (camera_fps <= 0 || (device_config->color_resolution == K4A_COLOR_RESOLUTION_OFF &&
-                            device_config->depth_mode == K4A_DEPTH_MODE_OFF))
+    if (config->roi.stage_box_enabled)
     {
-        std::cerr << "Either the color or depth modes must be enabled to record." << std::endl;
-        return 1;
-    }
-
-    if (absoluteExposureValue != defaultExposureAuto)
-    {
-        if (K4A_FAILED(k4a_device_set_color_control(device,
-                                                    K4A_COLOR_CONTROL_EXPOSURE_TIME_ABSOLUTE,
-                                                    K4A_COLOR_CONTROL_MODE_MANUAL,
-                                                    absoluteExposureValue)))
+        // The calibration blob is the slowest read at startup; reuse the copy cached for this serial number.
+        std::vector<uint8_t> raw_calibration;
+        bool from_cache = false;
+        if (get_cached_raw_calibration(device, serial_number_buffer, &version_info, &raw_calibration, &from_cache))
         {
-            std::cerr << "Runtime error: k4a_device_set_color_control() for manual exposure failed " << std::endl;
+            if (raw_calibration.back() != '\0')
+            {
+                raw_calibration.push_back('\0');
+            }
+            context->calibration_valid = K4A_SUCCEEDED(k4a_calibration_get_from_raw((char *)raw_calibration.data(),
+                                                                                    raw_calibration.size(),
+                                                                                    device_config->depth_mode,
+                                                                                    device_config->color_resolution,
+                                                                                    &context->calibration));
         }
-    }
-    else
-    {
-        if (K4A_FAILED(k4a_device_set_color_control(device,
-                                                    K4A_COLOR_CONTROL_EXPOSURE_TIME_ABSOLUTE,
-                                                    K4A_COLOR_CONTROL_MODE_AUTO,
-                                                    0)))
+        if (!context->calibration_valid)
         {
-            std::cerr << "Runtime error: k4a_device_set_color_control() for auto exposure failed " << std::endl;
+            std::cerr << "Runtime error: unable to read the device calibration, stage box ignored" << std::endl;
         }
     }
+    context->source = new device_capture_source(device);
+    return 0;
+}
 
-    if (gain != defaultGainAuto)
+static void close_device(recorder_context_t *context)
+{
+    if (context->streaming)
     {
-        if (K4A_FAILED(
-                k4a_device_set_color_control(device, K4A_COLOR_CONTROL_GAIN, K4A_COLOR_CONTROL_MODE_MANUAL, gain)))
+        if (context->config->record_imu)
         {
-            std::cerr << "Runtime error: k4a_device_set_color_control() for manual gain failed " << std::endl;
+            context->source->stop_imu();
         }
+        context->source->stop_cameras();
     }
+    delete context->source;
+    context->source = NULL;
+}
 
-    if (brightness != defaultBrightness)
-    {
-    	if (K4A_FAILED(k4a_device_set_color_control(device,
-                                                K4A_COLOR_CONTROL_BRIGHTNESS,
-                                                K4A_COLOR_CONTROL_MODE_MANUAL,
-                                                brightness)))
-    	{
-            std::cerr << "Runtime error: k4a_device_set_color_control() for manual brightness failed " << std::endl;
-    	}
-    }
-
-    if (contrast != defaultContrast)
-    {
-    	if (K4A_FAILED(k4a_device_set_color_control(device,
-                                                K4A_COLOR_CONTROL_CONTRAST,
-                                                K4A_COLOR_CONTROL_MODE_MANUAL,
-                                                contrast)))
-    	{
-            std::cerr << "Runtime error: k4a_device_set_color_control() for manual contrast failed " << std::endl;
-    	}
-    }
-
-    if (saturation != defaultSaturation)
-    {
-    	if (K4A_FAILED(k4a_device_set_color_control(device,
-                                                K4A_COLOR_CONTROL_SATURATION,
-                                                K4A_COLOR_CONTROL_MODE_MANUAL,
-                                                saturation)))
-    	{
-            std::cerr << "Runtime error: k4a_device_set_color_control() for manual saturation failed " << std::endl;
-    	}
-    }
-
-    if (sharpness != defaultSharpness)
-    {
-    	if (K4A_FAILED(k4a_device_set_color_control(device,
-                                                K4A_COLOR_CONTROL_SHARPNESS,
-                                                K4A_COLOR_CONTROL_MODE_MANUAL,
-                                                sharpness)))
-    	{
-            std::cerr << "Runtime error: k4a_device_set_color_control() for manual sharpness failed " << std::endl;
-    	}
-    }
+// Starts the cameras and the IMU without waiting for a capture.
+static int start_cameras(recorder_context_t *context)
+{
+    capture_source *source = context->source;
 
-    if (whitebalance != defaultWhitebalance)  // Add this block for whitebalance
+    if (K4A_FAILED(source->start_cameras(&context->config->device_config)))
     {
-    	if (K4A_FAILED(k4a_device_set_color_control(device,
-                                                K4A_COLOR_CONTROL_WHITEBALANCE,
-                                                K4A_COLOR_CONTROL_MODE_MANUAL,
-                                                whitebalance)))
-    	{
-            std::cerr << "Runtime error: k4a_device_set_color_control() for manual whitebalance failed " << std::endl;
-    	}
+        std::cerr << "Runtime error: k4a_device_start_cameras() failed" << std::endl;
+        return 1;
     }
-
-    CHECK(k4a_device_start_cameras(device, device_config), device);
-    if (record_imu)
+    if (context->config->record_imu && K4A_FAILED(source->start_imu()))
     {
-        CHECK(k4a_device_start_imu(device), device);
+        std::cerr << "Runtime error: k4a_device_start_imu() failed" << std::endl;
+        source->stop_cameras();
+        return 1;
     }
+    context->streaming = true;
 
     std::cout << "Device started" << std::endl;
+    return 0;
+}
 
-    k4a_record_t recording;
-    if (K4A_FAILED(k4a_record_create(recording_filename, device, *device_config, &recording)))
-    {
-        std::cerr << "Unable to create recording file: " << recording_filename << std::endl;
-        return 1;
-    }
+// Starts the cameras and waits for the first capture. On failure the device is closed. Returns 0 without a capture
+// if Ctrl-C was pressed while waiting.
+static int start_streaming(recorder_context_t *context)
+{
+    const k4a_device_configuration_t *device_config = &context->config->device_config;
+    capture_source *source = context->source;
 
-    if (record_imu)
+    if (start_cameras(context) != 0)
     {
-        CHECK(k4a_record_add_imu_track(recording), device);
+        close_device(context);
+        return 1;
     }
-    CHECK(k4a_record_write_header(recording), device);
 
     // Wait for the first capture before starting recording.
     k4a_capture_t capture;
@@ -213,12 +369,13 @@ int do_recording(uint8_t device_index,
         timeout_sec_for_first_capture = 360;
         std::cout << "[subordinate mode] Waiting for signal from master" << std::endl;
     }
-    clock_t first_capture_start = clock();
+    auto first_capture_deadline = std::chrono::steady_clock::now() +
+                                  std::chrono::seconds(timeout_sec_for_first_capture);
     k4a_wait_result_t result = K4A_WAIT_RESULT_TIMEOUT;
     // Wait for the first capture in a loop so Ctrl-C will still exit.
-    while (!exiting && (clock() - first_capture_start) < (CLOCKS_PER_SEC * timeout_sec_for_first_capture))
+    while (!exiting && std::chrono::steady_clock::now() < first_capture_deadline)
     {
-        result = k4a_device_get_capture(device, &capture, 100);
+        result = source->get_capture(&capture, 100);
         if (result == K4A_WAIT_RESULT_SUCCEEDED)
         {
             k4a_capture_release(capture);
@@ -227,32 +384,288 @@ int do_recording(uint8_t device_index,
         else if (result == K4A_WAIT_RESULT_FAILED)
         {
             std::cerr << "Runtime error: k4a_device_get_capture() returned error: " << result << std::endl;
+            close_device(context);
             return 1;
         }
     }
 
-    if (exiting)
+    if (!exiting && result == K4A_WAIT_RESULT_TIMEOUT)
+    {
+        std::cerr << "Timed out waiting for first capture." << std::endl;
+        close_device(context);
+        return 1;
+    }
+    return 0;
+}
+
+static uint64_t get_capture_device_timestamp_usec(k4a_capture_t capture)
+{
+    k4a_image_t image = k4a_capture_get_depth_image(capture);
+    if (image == NULL)
+    {
+        image = k4a_capture_get_ir_image(capture);
+    }
+    if (image == NULL)
+    {
+        image = k4a_capture_get_color_image(capture);
+    }
+    if (image == NULL)
     {
-        k4a_device_close(device);
         return 0;
     }
-    else if (result == K4A_WAIT_RESULT_TIMEOUT)
+    uint64_t timestamp_usec = k4a_image_get_device_timestamp_usec(image);
+    k4a_image_release(image);
+    return timestamp_usec;
+}
+
+// Updates the frame rate estimate with a new capture and returns the number of frames missing before it, judged by
+// gaps of more than one and a half frame periods between device timestamps.
+static uint32_t update_stream_stats(recorder_context_t *context, k4a_capture_t capture)
+{
+    stream_stats_t *stats = &context->stats;
+    auto now = std::chrono::steady_clock::now();
+    if (stats->fps_window_frames == 0)
     {
-        std::cerr << "Timed out waiting for first capture." << std::endl;
+        stats->fps_window_start = now;
+    }
+    stats->fps_window_frames++;
+    auto window = now - stats->fps_window_start;
+    if (window >= std::chrono::seconds(1))
+    {
+        stats->fps = (stats->fps_window_frames - 1) / std::chrono::duration<double>(window).count();
+        stats->fps_window_frames = 1;
+        stats->fps_window_start = now;
+    }
+
+    uint32_t dropped = 0;
+    uint64_t timestamp_usec = get_capture_device_timestamp_usec(capture);
+    uint64_t period_usec = 1000000 / context->camera_fps;
+    if (stats->last_device_timestamp_usec != 0 && timestamp_usec > stats->last_device_timestamp_usec &&
+        timestamp_usec - stats->last_device_timestamp_usec > period_usec * 3 / 2)
+    {
+        dropped = (uint32_t)((timestamp_usec - stats->last_device_timestamp_usec + period_usec / 2) / period_usec - 1);
+    }
+    if (timestamp_usec != 0)
+    {
+        stats->last_device_timestamp_usec = timestamp_usec;
+    }
+    return dropped;
+}
+
+// A take from arm to stop: the file is created and its header written when armed, so starting only costs the wait
+// for the next capture.
+typedef struct
+{
+    std::string filename;
+    int recording_length;
+    k4a_record_t recording;
+    std::unique_ptr<capture_writer> writer;
+    frame_metadata_writer metadata;
+    storage_monitor storage;
+    uint64_t frames;
+    uint64_t drops;
+    // Kept for the soak report when faults are injected.
+    latency_histogram write_latency;
+    uint64_t rss_baseline_kb;
+} take_t;
+
+static void send_reply(const session_command_t *command, const std::string &response)
+{
+    if (command->reply)
+    {
+        command->reply(response);
+    }
+    else
+    {
+        (response.compare(0, 3, "ERR") == 0 ? std::cerr : std::cout) << response << std::endl;
+    }
+}
+
+static const char *sync_role_name(k4a_wired_sync_mode_t mode)
+{
+    switch (mode)
+    {
+    case K4A_WIRED_SYNC_MODE_MASTER:
+        return "master";
+    case K4A_WIRED_SYNC_MODE_SUBORDINATE:
+        return "subordinate";
+    default:
+        return "standalone";
+    }
+}
+
+static std::string format_status(const recorder_context_t *context, const char *state, const take_t *take)
+{
+    uint64_t free_bytes = 0;
+    bool free_known = get_free_disk_space(take != NULL ? take->filename.c_str() : ".", &free_bytes);
+
+    std::ostringstream status;
+    status << "OK state=" << state << " sync=" << sync_role_name(context->config->device_config.wired_sync_mode)
+           << " file=" << (take != NULL ? take->filename : "-") << " frames=" << (take != NULL ? take->frames : 0)
+           << " drops=" << (take != NULL ? take->drops : 0) << " fps=" << std::fixed << std::setprecision(1)
+           << context->stats.fps << " disk_free_mb=";
+    if (free_known)
+    {
+        status << free_bytes / (1024 * 1024);
+    }
+    else
+    {
+        status << "-";
+    }
+    if (take != NULL && take->frames > 0 && take->storage.seconds_to_full() >= 0)
+    {
+        status << " time_to_full_s=" << (uint64_t)take->storage.seconds_to_full();
+    }
+    return status.str();
+}
+
+// Checks the storage, creates the recording file and writes its header. Returns 2 if the storage check refused the
+// take.
+static int arm_take(recorder_context_t *context, const char *recording_filename, int recording_length, take_t *take)
+{
+    const recorder_config_t *config = context->config;
+
+    if (check_storage_admission(config, recording_filename, recording_length) != 0)
+    {
+        return 2;
+    }
+    if (K4A_FAILED(k4a_record_create(recording_filename,
+                                     context->source->device(),
+                                     config->device_config,
+                                     &take->recording)))
+    {
+        std::cerr << "Unable to create recording file: " << recording_filename << std::endl;
+        return 1;
+    }
+
+    take->filename = recording_filename;
+    take->recording_length = recording_length;
+    take->frames = 0;
+    take->drops = 0;
+    take->rss_baseline_kb = 0;
+    take->write_latency = latency_histogram();
+    take->writer.reset(new capture_writer(take->recording, &config->device_config));
+    k4a_result_t roi_result = take->writer->set_roi(&config->roi,
+                                                    context->calibration_valid ? &context->calibration : NULL);
+    take->writer->set_ir_mode(config->ir_mode);
+    if (config->depth_delta)
+    {
+        take->writer->set_depth_delta(config->depth_delta_keyframe_interval, config->depth_delta_threshold);
+    }
+    if (K4A_FAILED(roi_result) || K4A_FAILED(take->writer->add_tracks()) ||
+        (config->record_imu && K4A_FAILED(k4a_record_add_imu_track(take->recording))) ||
+        K4A_FAILED(k4a_record_write_header(take->recording)))
+    {
+        std::cerr << "Runtime error: unable to write the header of " << recording_filename << std::endl;
+        k4a_record_close(take->recording);
+        take->writer.reset();
         return 1;
     }
 
-    std::cout << "Started recording" << std::endl;
-    if (recording_length <= 0)
+    if (config->frame_metadata && !take->metadata.open(frame_metadata_path(recording_filename).c_str()))
     {
-        std::cout << "Press Ctrl-C to stop recording." << std::endl;
+        std::cerr << "Unable to create frame metadata file: " << frame_metadata_path(recording_filename) << std::endl;
     }
+    return 0;
+}
+
+// Closes an armed take that never started and removes its files.
+static void disarm_take(take_t *take)
+{
+    k4a_record_close(take->recording);
+    take->writer.reset();
+    take->metadata.close();
+    std::remove(take->filename.c_str());
+    std::remove(frame_metadata_path(take->filename.c_str()).c_str());
+}
 
-    clock_t recording_start = clock();
-    int32_t timeout_ms = 1000 / camera_fps;
+static int finish_take(take_t *take)
+{
+    int status = 0;
+    std::cout << "Saving recording..." << std::endl;
+    k4a_result_t flush_result = k4a_record_flush(take->recording);
+    if (K4A_FAILED(flush_result))
+    {
+        std::cerr << "Runtime error: k4a_record_flush(recording) returned " << flush_result << std::endl;
+        status = 1;
+    }
+    k4a_record_close(take->recording);
+    take->writer->print_summary();
+    take->writer.reset();
+    if (!take->metadata.close())
+    {
+        std::cerr << "Runtime error: writing " << frame_metadata_path(take->filename.c_str()) << " failed"
+                  << std::endl;
+    }
+
+    std::cout << "Done" << std::endl;
+    return status;
+}
+
+// Records an armed take from the streaming source. With a command queue, the take also ends on "stop" or "quit";
+// quit is set for the latter and the command is returned in stop_command to be answered once the file is closed.
+// start_command, if given, is answered when the first capture has been written.
+static int run_take(recorder_context_t *context,
+                    take_t *take,
+                    const session_command_t *start_command,
+                    session_command_queue *commands,
+                    session_command_t *stop_command,
+                    bool *quit)
+{
+    const recorder_config_t *config = context->config;
+    capture_source *source = context->source;
+    k4a_record_t recording = take->recording;
+
+    std::cout << "Started recording " << take->filename << std::endl;
+    if (take->recording_length <= 0)
+    {
+        std::cout << (commands != NULL ? "Send stop to stop recording." : "Press Ctrl-C to stop recording.")
+                  << std::endl;
+    }
+
+    int status = 0;
+    bool stop_requested = false;
+    k4a_capture_t capture;
+    k4a_wait_result_t result;
+    auto recording_start = std::chrono::steady_clock::now();
+    auto recording_end = recording_start + std::chrono::seconds(take->recording_length);
+    int32_t timeout_ms = 1000 / context->camera_fps;
+    take->storage.start(take->filename.c_str(), config->min_free_mb, estimate_recording_bytes_per_second(config));
+    if (context->faults != NULL)
+    {
+        context->faults->set_active(true);
+    }
     do
     {
-        result = k4a_device_get_capture(device, &capture, timeout_ms);
+        session_command_t command;
+        while (commands != NULL && commands->try_pop(&command))
+        {
+            switch (command.type)
+            {
+            case SESSION_COMMAND_ARM:
+            case SESSION_COMMAND_START:
+                send_reply(&command, "ERR already recording " + take->filename);
+                break;
+            case SESSION_COMMAND_STATUS:
+                send_reply(&command, format_status(context, "recording", take));
+                break;
+            case SESSION_COMMAND_QUIT:
+                *quit = true;
+                *stop_command = command;
+                stop_requested = true;
+                break;
+            case SESSION_COMMAND_STOP:
+                *stop_command = command;
+                stop_requested = true;
+                break;
+            }
+        }
+        if (stop_requested)
+        {
+            break;
+        }
+
+        result = source->get_capture(&capture, timeout_ms);
         if (result == K4A_WAIT_RESULT_TIMEOUT)
         {
             continue;
@@ -260,17 +673,61 @@ int do_recording(uint8_t device_index,
         else if (result != K4A_WAIT_RESULT_SUCCEEDED)
         {
             std::cerr << "Runtime error: k4a_device_get_capture() returned " << result << std::endl;
+            status = 1;
             break;
         }
-        CHECK(k4a_record_write_capture(recording, capture), device);
+        uint32_t dropped = update_stream_stats(context, capture);
+        if (take->frames > 0)
+        {
+            take->drops += dropped;
+        }
+        if (context->faults != NULL)
+        {
+            context->faults->before_write();
+        }
+        auto write_start = std::chrono::steady_clock::now();
+        k4a_result_t write_result = take->writer->write_capture(capture);
+        take->metadata.append(capture);
+        if (context->faults != NULL)
+        {
+            take->write_latency.add((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                                        std::chrono::steady_clock::now() - write_start)
+                                        .count());
+            process_usage_t usage;
+            if (take->frames == context->camera_fps * 2 && get_process_usage(&usage))
+            {
+                take->rss_baseline_kb = usage.rss_kb;
+            }
+        }
+        uint64_t first_frame_usec = take->frames == 0 ? get_capture_device_timestamp_usec(capture) : 0;
         k4a_capture_release(capture);
+        if (K4A_FAILED(write_result))
+        {
+            std::cerr << "Runtime error: writer.write_capture(capture) returned " << write_result << std::endl;
+            status = 1;
+            break;
+        }
+        if (take->frames++ == 0 && start_command != NULL)
+        {
+            auto latency = std::chrono::steady_clock::now() - start_command->received;
+            std::ostringstream response;
+            response << "OK started latency_us="
+                     << std::chrono::duration_cast<std::chrono::microseconds>(latency).count()
+                     << " first_frame_usec=" << first_frame_usec;
+            send_reply(start_command, response.str());
+        }
+        if (config->storage_check != STORAGE_CHECK_OFF && !take->storage.poll())
+        {
+            status = 1;
+            break;
+        }
 
-        if (record_imu)
+        if (config->record_imu)
         {
             do
             {
                 k4a_imu_sample_t sample;
-                result = k4a_device_get_imu_sample(device, &sample, 0);
+                result = source->get_imu_sample(&sample, 0);
                 if (result == K4A_WAIT_RESULT_TIMEOUT)
                 {
                     break;
@@ -287,30 +744,271 @@ int do_recording(uint8_t device_index,
                     break;
                 }
             } while (!exiting && result != K4A_WAIT_RESULT_FAILED &&
-                     (recording_length < 0 || (clock() - recording_start < recording_length * CLOCKS_PER_SEC)));
+                     (take->recording_length < 0 || std::chrono::steady_clock::now() < recording_end));
         }
     } while (!exiting && result != K4A_WAIT_RESULT_FAILED &&
-             (recording_length < 0 || (clock() - recording_start < recording_length * CLOCKS_PER_SEC)));
+             (take->recording_length < 0 || std::chrono::steady_clock::now() < recording_end));
+
+    if (context->faults != NULL)
+    {
+        context->faults->set_active(false);
+    }
+    if (start_command != NULL && take->frames == 0)
+    {
+        send_reply(start_command, "ERR no capture was written");
+    }
 
     if (!exiting)
     {
-        exiting = true;
+        if (commands == NULL)
+        {
+            exiting = true;
+        }
         std::cout << "Stopping recording..." << std::endl;
     }
+    return status;
+}
 
-    if (record_imu)
+// One line for the soak harness (see soak.h): how the take ended, write latency percentiles, memory growth during
+// the take, and descriptors and images still open after the device was closed.
+static void print_soak_report(const take_t *take,
+                              int status,
+                              const process_usage_t *usage_before,
+                              const fault_counts_t *faults)
+{
+    process_usage_t usage;
+    if (!get_process_usage(&usage))
     {
-        k4a_device_stop_imu(device);
+        return;
     }
-    k4a_device_stop_cameras(device);
+    uint64_t rss_growth_kb = take->rss_baseline_kb != 0 && usage.rss_kb > take->rss_baseline_kb ?
+                                 usage.rss_kb - take->rss_baseline_kb :
+                                 0;
+    std::cout << "SOAK status=" << status << " frames=" << take->frames << " drops=" << take->drops
+              << " write_p50_us=" << take->write_latency.percentile_usec(0.5)
+              << " write_p99_us=" << take->write_latency.percentile_usec(0.99)
+              << " write_max_us=" << take->write_latency.max_usec() << " rss_kb=" << usage.rss_kb
+              << " peak_rss_kb=" << usage.peak_rss_kb << " rss_growth_kb=" << rss_growth_kb
+              << " fd_growth=" << std::max(usage.open_fds - usage_before->open_fds, 0)
+              << " live_images=" << synthetic_capture_source::live_images() << " slow_writes=" << faults->slow_writes
+              << " wait_failures=" << faults->wait_failures << " timestamp_jumps=" << faults->timestamp_jumps
+              << " imu_reorders=" << faults->imu_reorders << std::endl;
+}
 
-    std::cout << "Saving recording..." << std::endl;
-    CHECK(k4a_record_flush(recording), device);
-    k4a_record_close(recording);
+int do_recording(const recorder_config_t *config, const char *recording_filename)
+{
+    process_usage_t usage_before = {};
+    if (config->faults.enabled)
+    {
+        get_process_usage(&usage_before);
+    }
+    recorder_context_t context;
+    if (open_device(config, &context) != 0 || start_streaming(&context) != 0)
+    {
+        return 1;
+    }
 
-    std::cout << "Done" << std::endl;
+    take_t take;
+    take.frames = 0;
+    take.drops = 0;
+    take.rss_baseline_kb = 0;
+    int status = 0;
+    if (!exiting)
+    {
+        if (arm_take(&context, recording_filename, config->recording_length, &take) != 0)
+        {
+            status = 1;
+        }
+        else
+        {
+            status = run_take(&context, &take, NULL, NULL, NULL, NULL);
+            status = finish_take(&take) != 0 ? 1 : status;
+        }
+    }
 
-    k4a_device_close(device);
+    // Counted after the source is gone, so that images it still holds show up as leaks.
+    bool soak_report = context.faults != NULL;
+    fault_counts_t fault_counts = {};
+    if (soak_report)
+    {
+        fault_counts = *context.faults->counts();
+    }
+    close_device(&context);
+    if (soak_report)
+    {
+        print_soak_report(&take, status, &usage_before, &fault_counts);
+    }
+    return status;
+}
 
-    return 0;
+// Arms a take for a start or arm command, answering the command on failure. The cameras are started by the first
+// take, so that a rig can arm its subordinates before the master starts sending the sync signal.
+static bool arm_take_for_command(recorder_context_t *context, const session_command_t *command, take_t *take)
+{
+    if (!context->streaming)
+    {
+        if (start_cameras(context) != 0)
+        {
+            send_reply(command, "ERR unable to start the cameras");
+            return false;
+        }
+        if (context->config->device_config.wired_sync_mode == K4A_WIRED_SYNC_MODE_SUBORDINATE)
+        {
+            std::cout << "[subordinate mode] Waiting for signal from master" << std::endl;
+        }
+    }
+    int recording_length = command->recording_length > 0 ? command->recording_length :
+                                                            context->config->recording_length;
+    std::string filename = context->config->output_dir + "/" + command->filename;
+    int status = arm_take(context, filename.c_str(), recording_length, take);
+    if (status != 0)
+    {
+        send_reply(command,
+                   (status == 2 ? "ERR storage check failed for " : "ERR unable to create ") + command->filename);
+        return false;
+    }
+    return true;
+}
+
+int do_session(const recorder_config_t *config)
+{
+    recorder_context_t context;
+    if (open_device(config, &context) != 0)
+    {
+        return 1;
+    }
+
+    // Take commands before the cameras run: a subordinate waiting for its master must already be reachable. The
+    // queue is shared with the reader threads, which are detached and may still push commands after the session ended.
+    std::shared_ptr<session_command_queue> commands = std::make_shared<session_command_queue>();
+    start_stdin_command_reader(commands, config->control_port == 0);
+    if (config->control_port != 0 &&
+        start_control_server(config->control_bind.c_str(), config->control_port, commands) != 0)
+    {
+        close_device(&context);
+        return 1;
+    }
+    std::cout << "Session ready. Commands: arm <output.mkv> [seconds], start [<output.mkv> [seconds]], stop, status, "
+                 "quit"
+              << std::endl;
+
+    // Once started, keep the cameras streaming between takes and drop the frames, so a take starts with the next fresh
+    // capture.
+    int status = 0;
+    bool quit = false;
+    bool armed = false;
+    take_t take;
+    int32_t timeout_ms = 1000 / context.camera_fps;
+    while (!exiting && !quit)
+    {
+        session_command_t command;
+        while (!quit && commands->try_pop(&command))
+        {
+            switch (command.type)
+            {
+            case SESSION_COMMAND_ARM:
+                if (armed)
+                {
+                    send_reply(&command, "ERR already armed " + take.filename);
+                }
+                else if (arm_take_for_command(&context, &command, &take))
+                {
+                    armed = true;
+                    std::cout << "Armed " << take.filename << std::endl;
+                    send_reply(&command, "OK armed file=" + take.filename);
+                }
+                break;
+            case SESSION_COMMAND_START:
+            {
+                if (!command.filename.empty() && armed)
+                {
+                    send_reply(&command, "ERR already armed " + take.filename);
+                    break;
+                }
+                if (command.filename.empty() && !armed)
+                {
+                    send_reply(&command, "ERR nothing armed");
+                    break;
+                }
+                if (!armed && !arm_take_for_command(&context, &command, &take))
+                {
+                    break;
+                }
+                armed = false;
+
+                session_command_t stop_command;
+                stop_command.reply = nullptr;
+                stop_command.type = SESSION_COMMAND_START;
+                // A failed take fails the session, even if later takes succeed.
+                status |= run_take(&context, &take, &command, commands.get(), &stop_command, &quit);
+                if (finish_take(&take) != 0)
+                {
+                    status = 1;
+                }
+                if (stop_command.type != SESSION_COMMAND_START)
+                {
+                    std::ostringstream response;
+                    response << "OK stopped file=" << take.filename << " frames=" << take.frames
+                             << " drops=" << take.drops;
+                    send_reply(&stop_command, response.str());
+                }
+                break;
+            }
+            case SESSION_COMMAND_STOP:
+                if (armed)
+                {
+                    disarm_take(&take);
+                    armed = false;
+                    send_reply(&command, "OK disarmed file=" + take.filename);
+                }
+                else
+                {
+                    send_reply(&command, "ERR not recording");
+                }
+                break;
+            case SESSION_COMMAND_STATUS:
+                send_reply(&command, format_status(&context, armed ? "armed" : "idle", armed ? &take : NULL));
+                break;
+            case SESSION_COMMAND_QUIT:
+                quit = true;
+                send_reply(&command, "OK quit");
+                break;
+            }
+        }
+        if (exiting || quit)
+        {
+            break;
+        }
+
+        if (!context.streaming)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+            continue;
+        }
+        k4a_capture_t capture;
+        k4a_wait_result_t result = context.source->get_capture(&capture, timeout_ms);
+        if (result == K4A_WAIT_RESULT_SUCCEEDED)
+        {
+            update_stream_stats(&context, capture);
+            k4a_capture_release(capture);
+        }
+        else if (result == K4A_WAIT_RESULT_FAILED)
+        {
+            std::cerr << "Runtime error: k4a_device_get_capture() returned " << result << std::endl;
+            status = 1;
+            break;
+        }
+
+        k4a_imu_sample_t sample;
+        while (config->record_imu && context.source->get_imu_sample(&sample, 0) == K4A_WAIT_RESULT_SUCCEEDED)
+        {
+        }
+    }
+
+    if (armed)
+    {
+        disarm_take(&take);
+    }
+    close_device(&context);
+    return status;
 }
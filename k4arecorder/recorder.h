@@ -2,8 +2,13 @@
 #define RECORDER_H
 
 #include <atomic>
+#include <string>
 #include <k4a/k4a.h>
 
+#include "capture_source.h"
+#include "ir_transform.h"
+#include "roi.h"
+
 extern std::atomic_bool exiting;
 
 // Default control values
@@ -15,18 +20,75 @@ static const int32_t defaultContrast             = 50;
 static const int32_t defaultSaturation           = 50;
 static const int32_t defaultSharpness            = 50;
 
-int do_recording(uint8_t device_index,
-                 char *recording_filename,
-                 int recording_length,
-                 k4a_device_configuration_t *device_config,
-                 bool record_imu,
-                 int32_t absoluteExposureValue,
-                 int32_t whitebalance,
-                 int32_t gain,
-                 int32_t brightness,
-                 int32_t contrast,
-                 int32_t saturation,
-                 int32_t sharpness);
+typedef struct
+{
+    int32_t absoluteExposureValue;
+    int32_t whitebalance;
+    int32_t gain;
+    int32_t brightness;
+    int32_t contrast;
+    int32_t saturation;
+    int32_t sharpness;
+} color_control_settings_t;
 
-#endif /* RECORDER_H */
+// What to do when the target filesystem looks too slow or too full for a take (see storage.h).
+typedef enum
+{
+    STORAGE_CHECK_OFF,
+    STORAGE_CHECK_WARN,
+    STORAGE_CHECK_REFUSE
+} storage_check_t;
+
+// Everything a take needs, filled from the command line and/or a config file (see config.h).
+typedef struct
+{
+    uint8_t device_index;
+    int recording_length;
+    k4a_device_configuration_t device_config;
+    bool recording_rate_set;
+    bool record_imu;
+    color_control_settings_t color_controls;
+    roi_settings_t roi;
+    bool frame_metadata;
+    // Delta code depth into the DEPTH_DELTA track (see depth_delta.h).
+    bool depth_delta;
+    uint32_t depth_delta_keyframe_interval;
+    uint16_t depth_delta_threshold;
+    ir_mode_t ir_mode;
+    // Generate captures instead of opening a device (see capture_source.h).
+    bool synthetic;
+    // Faults injected into the synthetic source for soak runs (see soak.h).
+    fault_injection_t faults;
+    // TCP port for session commands, 0 to read them from stdin only.
+    uint16_t control_port;
+    // IPv4 address the control server listens on; loopback unless the rig network is given explicitly.
+    std::string control_bind;
+    // Directory that session take file names are resolved in.
+    std::string output_dir;
+    storage_check_t storage_check;
+    // Free space kept on the disk; a take stops before going below it.
+    uint32_t min_free_mb;
+} recorder_config_t;
+
+uint32_t k4a_convert_fps_to_uint(k4a_fps_t fps);
 
+// Image dimensions of the camera modes, false if the mode is off or unknown.
+bool get_color_resolution_size(k4a_color_resolution_t resolution, int *width, int *height);
+bool get_depth_mode_size(k4a_depth_mode_t depth_mode, int *width, int *height);
+
+// Opens the device, records a single take and closes the device again.
+int do_recording(const recorder_config_t *config, const char *recording_filename);
+
+// Opens the device once and keeps the cameras streaming while takes are armed, started and stopped with commands
+// read from stdin and, if control_port is set, from TCP connections (see session.h for the commands). Each command
+// gets one response line:
+//   OK armed file=<output.mkv>
+//   OK started latency_us=<command to first written frame> first_frame_usec=<device timestamp>
+//   OK stopped file=<output.mkv> frames=<n> drops=<n>
+//   OK state=<idle|armed|recording> sync=<standalone|master|subordinate> file=<f> frames=<n> drops=<n> fps=<f>
+//      disk_free_mb=<n>
+//   ERR <message>
+// A take starts with the next frame after its command is read.
+int do_session(const recorder_config_t *config);
+
+#endif /* RECORDER_H */
@@ -0,0 +1,319 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "roi.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#if defined(K4ARECORDER_USE_TURBOJPEG)
+#include <turbojpeg.h>
+#endif
+
+bool parse_roi_rect(const char *str, roi_rect_t *rect)
+{
+    int x, y, width, height;
+    char trailing;
+    if (sscanf(str, "%d,%d,%d,%d%c", &x, &y, &width, &height, &trailing) != 4)
+    {
+        return false;
+    }
+    if (x < 0 || y < 0 || width <= 0 || height <= 0)
+    {
+        return false;
+    }
+    rect->x = x;
+    rect->y = y;
+    rect->width = width;
+    rect->height = height;
+    return true;
+}
+
+bool parse_stage_box(const char *str, k4a_float3_t *min_mm, k4a_float3_t *max_mm)
+{
+    float v[6];
+    char trailing;
+    if (sscanf(str, "%f,%f,%f,%f,%f,%f%c", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &trailing) != 6)
+    {
+        return false;
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        min_mm->v[i] = std::min(v[i], v[i + 3]);
+        max_mm->v[i] = std::max(v[i], v[i + 3]);
+    }
+    return min_mm->xyz.z > 0;
+}
+
+k4a_result_t roi_from_stage_box(const k4a_calibration_t *calibration,
+                                const k4a_float3_t *min_mm,
+                                const k4a_float3_t *max_mm,
+                                k4a_calibration_type_t target_camera,
+                                roi_rect_t *rect)
+{
+    const k4a_calibration_camera_t *camera = target_camera == K4A_CALIBRATION_TYPE_COLOR ?
+                                                 &calibration->color_camera_calibration :
+                                                 &calibration->depth_camera_calibration;
+    float x_min = INFINITY, y_min = INFINITY, x_max = -INFINITY, y_max = -INFINITY;
+    int projected = 0;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        k4a_float3_t point;
+        point.xyz.x = (corner & 1) ? max_mm->xyz.x : min_mm->xyz.x;
+        point.xyz.y = (corner & 2) ? max_mm->xyz.y : min_mm->xyz.y;
+        point.xyz.z = (corner & 4) ? max_mm->xyz.z : min_mm->xyz.z;
+
+        k4a_float2_t pixel;
+        int valid = 0;
+        if (K4A_SUCCEEDED(k4a_calibration_3d_to_2d(
+                calibration, &point, K4A_CALIBRATION_TYPE_DEPTH, target_camera, &pixel, &valid)) &&
+            valid)
+        {
+            projected++;
+        }
+        else
+        {
+            // A corner outside the field of view has no pixel. Its undistorted pinhole projection still lies past
+            // the image edge on the side the box leaves the view, so the rectangle reaches that edge once clamped.
+            k4a_float3_t target_point;
+            if (K4A_FAILED(k4a_calibration_3d_to_3d(
+                    calibration, &point, K4A_CALIBRATION_TYPE_DEPTH, target_camera, &target_point)) ||
+                target_point.xyz.z <= 0)
+            {
+                continue;
+            }
+            const auto &intrinsics = camera->intrinsics.parameters.param;
+            pixel.xy.x = intrinsics.cx + intrinsics.fx * target_point.xyz.x / target_point.xyz.z;
+            pixel.xy.y = intrinsics.cy + intrinsics.fy * target_point.xyz.y / target_point.xyz.z;
+            pixel.xy.x = std::min(std::max(pixel.xy.x, -1.0f), (float)camera->resolution_width);
+            pixel.xy.y = std::min(std::max(pixel.xy.y, -1.0f), (float)camera->resolution_height);
+        }
+        x_min = std::min(x_min, pixel.xy.x);
+        y_min = std::min(y_min, pixel.xy.y);
+        x_max = std::max(x_max, pixel.xy.x);
+        y_max = std::max(y_max, pixel.xy.y);
+    }
+    if (projected == 0)
+    {
+        return K4A_RESULT_FAILED;
+    }
+
+    rect->x = (int32_t)std::floor(x_min);
+    rect->y = (int32_t)std::floor(y_min);
+    rect->width = (int32_t)std::ceil(x_max) - rect->x + 1;
+    rect->height = (int32_t)std::ceil(y_max) - rect->y + 1;
+    return K4A_RESULT_SUCCEEDED;
+}
+
+bool roi_clamp(roi_rect_t *rect, int image_width, int image_height, int alignment)
+{
+    int32_t x0 = std::max(rect->x, 0);
+    int32_t y0 = std::max(rect->y, 0);
+    int32_t x1 = std::min(rect->x + rect->width, image_width);
+    int32_t y1 = std::min(rect->y + rect->height, image_height);
+    if (x1 <= x0 || y1 <= y0)
+    {
+        return false;
+    }
+
+    x0 -= x0 % alignment;
+    y0 -= y0 % alignment;
+    x1 = std::min((x1 + alignment - 1) / alignment * alignment, image_width);
+    y1 = std::min((y1 + alignment - 1) / alignment * alignment, image_height);
+
+    rect->x = x0;
+    rect->y = y0;
+    rect->width = x1 - x0;
+    rect->height = y1 - y0;
+    return true;
+}
+
+bool roi_supports_format(k4a_image_format_t format)
+{
+    switch (format)
+    {
+    case K4A_IMAGE_FORMAT_DEPTH16:
+    case K4A_IMAGE_FORMAT_IR16:
+    case K4A_IMAGE_FORMAT_CUSTOM16:
+    case K4A_IMAGE_FORMAT_COLOR_YUY2:
+    case K4A_IMAGE_FORMAT_COLOR_BGRA32:
+    case K4A_IMAGE_FORMAT_COLOR_NV12:
+        return true;
+#if defined(K4ARECORDER_USE_TURBOJPEG)
+    case K4A_IMAGE_FORMAT_COLOR_MJPG:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+int roi_alignment_for_format(k4a_image_format_t format)
+{
+    switch (format)
+    {
+    case K4A_IMAGE_FORMAT_COLOR_MJPG:
+        // Lossless JPEG cropping works on whole MCUs.
+        return 16;
+    case K4A_IMAGE_FORMAT_COLOR_NV12:
+    case K4A_IMAGE_FORMAT_COLOR_YUY2:
+        // Chroma is shared between pixel pairs.
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+// Row-wise copy of a sub-rectangle. Each row is contiguous in both buffers, so memcpy moves it with the C library's
+// vectorized copy.
+static void roi_copy_rows(const uint8_t *src,
+                          int src_stride,
+                          uint8_t *dst,
+                          int dst_stride,
+                          size_t row_bytes,
+                          int rows)
+{
+    for (int row = 0; row < rows; row++)
+    {
+        memcpy(dst + (size_t)row * dst_stride, src + (size_t)row * src_stride, row_bytes);
+    }
+}
+
+static void roi_copy_image_metadata(k4a_image_t src, k4a_image_t dst)
+{
+    k4a_image_set_device_timestamp_usec(dst, k4a_image_get_device_timestamp_usec(src));
+    k4a_image_set_system_timestamp_nsec(dst, k4a_image_get_system_timestamp_nsec(src));
+    k4a_image_set_exposure_usec(dst, k4a_image_get_exposure_usec(src));
+    k4a_image_set_white_balance(dst, k4a_image_get_white_balance(src));
+    k4a_image_set_iso_speed(dst, k4a_image_get_iso_speed(src));
+}
+
+#if defined(K4ARECORDER_USE_TURBOJPEG)
+static void roi_free_jpeg(void *buffer, void *context)
+{
+    (void)context; // Unused
+    tjFree((unsigned char *)buffer);
+}
+
+static k4a_image_t roi_crop_mjpg(k4a_image_t image, const roi_rect_t *rect)
+{
+    // Only used from the recording thread.
+    static tjhandle transformer = tjInitTransform();
+    if (transformer == NULL)
+    {
+        return NULL;
+    }
+
+    tjtransform transform;
+    memset(&transform, 0, sizeof(transform));
+    transform.r.x = rect->x;
+    transform.r.y = rect->y;
+    transform.r.w = rect->width;
+    transform.r.h = rect->height;
+    transform.op = TJXOP_NONE;
+    transform.options = TJXOPT_CROP;
+
+    unsigned char *jpeg = NULL;
+    unsigned long jpeg_size = 0;
+    if (tjTransform(transformer,
+                    k4a_image_get_buffer(image),
+                    (unsigned long)k4a_image_get_size(image),
+                    1,
+                    &jpeg,
+                    &jpeg_size,
+                    &transform,
+                    0) != 0)
+    {
+        tjFree(jpeg);
+        return NULL;
+    }
+
+    k4a_image_t cropped = NULL;
+    if (K4A_FAILED(k4a_image_create_from_buffer(K4A_IMAGE_FORMAT_COLOR_MJPG,
+                                                rect->width,
+                                                rect->height,
+                                                0,
+                                                jpeg,
+                                                jpeg_size,
+                                                roi_free_jpeg,
+                                                NULL,
+                                                &cropped)))
+    {
+        tjFree(jpeg);
+        return NULL;
+    }
+    return cropped;
+}
+#endif
+
+k4a_image_t roi_crop_image(k4a_image_t image, const roi_rect_t *rect)
+{
+    k4a_image_format_t format = k4a_image_get_format(image);
+    int src_stride = k4a_image_get_stride_bytes(image);
+    const uint8_t *src = k4a_image_get_buffer(image);
+
+    k4a_image_t cropped = NULL;
+    switch (format)
+    {
+    case K4A_IMAGE_FORMAT_DEPTH16:
+    case K4A_IMAGE_FORMAT_IR16:
+    case K4A_IMAGE_FORMAT_CUSTOM16:
+    case K4A_IMAGE_FORMAT_COLOR_YUY2:
+    case K4A_IMAGE_FORMAT_COLOR_BGRA32:
+    {
+        int bytes_per_pixel = format == K4A_IMAGE_FORMAT_COLOR_BGRA32 ? 4 : 2;
+        int dst_stride = rect->width * bytes_per_pixel;
+        if (K4A_FAILED(k4a_image_create(format, rect->width, rect->height, dst_stride, &cropped)))
+        {
+            return NULL;
+        }
+        roi_copy_rows(src + (size_t)rect->y * src_stride + (size_t)rect->x * bytes_per_pixel,
+                      src_stride,
+                      k4a_image_get_buffer(cropped),
+                      dst_stride,
+                      (size_t)dst_stride,
+                      rect->height);
+        break;
+    }
+    case K4A_IMAGE_FORMAT_COLOR_NV12:
+    {
+        // Full resolution Y plane followed by a half height plane of interleaved UV pairs.
+        int src_height = k4a_image_get_height_pixels(image);
+        int dst_stride = rect->width;
+        if (K4A_FAILED(k4a_image_create(format, rect->width, rect->height, dst_stride, &cropped)))
+        {
+            return NULL;
+        }
+        uint8_t *dst = k4a_image_get_buffer(cropped);
+        roi_copy_rows(src + (size_t)rect->y * src_stride + rect->x,
+                      src_stride,
+                      dst,
+                      dst_stride,
+                      (size_t)rect->width,
+                      rect->height);
+        roi_copy_rows(src + (size_t)src_height * src_stride + (size_t)(rect->y / 2) * src_stride + rect->x,
+                      src_stride,
+                      dst + (size_t)rect->height * dst_stride,
+                      dst_stride,
+                      (size_t)rect->width,
+                      rect->height / 2);
+        break;
+    }
+#if defined(K4ARECORDER_USE_TURBOJPEG)
+    case K4A_IMAGE_FORMAT_COLOR_MJPG:
+        cropped = roi_crop_mjpg(image, rect);
+        if (cropped == NULL)
+        {
+            return NULL;
+        }
+        break;
+#endif
+    default:
+        return NULL;
+    }
+
+    roi_copy_image_metadata(image, cropped);
+    return cropped;
+}
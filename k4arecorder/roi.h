@@ -0,0 +1,61 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef ROI_H
+#define ROI_H
+
+#include <k4a/k4a.h>
+
+// Pixel rectangle inside a camera image.
+typedef struct
+{
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+} roi_rect_t;
+
+// Region-of-interest configuration. Explicit pixel rectangles take precedence; the stage box (in millimeters, in the
+// depth camera coordinate frame) is projected through the device calibration for any camera without one.
+typedef struct
+{
+    bool depth_enabled;
+    roi_rect_t depth;
+    bool color_enabled;
+    roi_rect_t color;
+    bool stage_box_enabled;
+    k4a_float3_t stage_min_mm;
+    k4a_float3_t stage_max_mm;
+} roi_settings_t;
+
+// Parses "x,y,width,height".
+bool parse_roi_rect(const char *str, roi_rect_t *rect);
+
+// Parses "xmin,ymin,zmin,xmax,ymax,zmax".
+bool parse_stage_box(const char *str, k4a_float3_t *min_mm, k4a_float3_t *max_mm);
+
+// Projects the corners of the stage box into the target camera and returns their bounding rectangle. Corners outside
+// the camera's field of view, such as a floor reaching past the image, extend the rectangle to the image edge on
+// their side, so the result can reach past the image; roi_clamp() limits it. Corners behind the camera are skipped.
+// Fails only if no corner projects into the image.
+k4a_result_t roi_from_stage_box(const k4a_calibration_t *calibration,
+                                const k4a_float3_t *min_mm,
+                                const k4a_float3_t *max_mm,
+                                k4a_calibration_type_t target_camera,
+                                roi_rect_t *rect);
+
+// Clamps the rectangle to the image and grows it outwards so that x, y and width are multiples of alignment.
+// Returns false if nothing of the rectangle is left inside the image.
+bool roi_clamp(roi_rect_t *rect, int image_width, int image_height, int alignment);
+
+// Whether images of the given format can be cropped by roi_crop_image().
+bool roi_supports_format(k4a_image_format_t format);
+
+// Pixel alignment required to crop images of the given format without re-sampling.
+int roi_alignment_for_format(k4a_image_format_t format);
+
+// Returns a new image holding the rectangle of the source image, with the source timestamps and exposure settings,
+// or NULL if the format cannot be cropped. The caller releases the returned image.
+k4a_image_t roi_crop_image(k4a_image_t image, const roi_rect_t *rect);
+
+#endif /* ROI_H */
@@ -0,0 +1,141 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "session.h"
+#include "config.h"
+
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+// True for a relative path that stays below the directory it is resolved in.
+static bool is_relative_take_name(const std::string &filename)
+{
+    if (filename.empty() || filename[0] == '/' || filename[0] == '\\' || filename.find(':') != std::string::npos)
+    {
+        return false;
+    }
+    size_t start = 0;
+    while (start <= filename.size())
+    {
+        size_t end = filename.find_first_of("/\\", start);
+        if (end == std::string::npos)
+        {
+            end = filename.size();
+        }
+        if (filename.compare(start, end - start, "..") == 0)
+        {
+            return false;
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+bool parse_session_command(const std::string &line, session_command_t *command, std::string *error)
+{
+    std::istringstream stream(line);
+    std::string verb;
+    stream >> verb;
+
+    command->filename.clear();
+    command->recording_length = -1;
+    command->received = std::chrono::steady_clock::now();
+    command->reply = nullptr;
+    if (string_compare(verb.c_str(), "arm") == 0 || string_compare(verb.c_str(), "start") == 0)
+    {
+        command->type = string_compare(verb.c_str(), "arm") == 0 ? SESSION_COMMAND_ARM : SESSION_COMMAND_START;
+        if (!(stream >> command->filename))
+        {
+            if (command->type == SESSION_COMMAND_ARM)
+            {
+                *error = "arm needs an output file name";
+                return false;
+            }
+            return true;
+        }
+        if (!is_relative_take_name(command->filename))
+        {
+            *error = "Output file must be a relative path without ..: " + command->filename;
+            return false;
+        }
+        int recording_length;
+        if (stream >> recording_length)
+        {
+            if (recording_length <= 0)
+            {
+                *error = "Recording length must be positive";
+                return false;
+            }
+            command->recording_length = recording_length;
+        }
+    }
+    else if (string_compare(verb.c_str(), "stop") == 0)
+    {
+        command->type = SESSION_COMMAND_STOP;
+    }
+    else if (string_compare(verb.c_str(), "status") == 0)
+    {
+        command->type = SESSION_COMMAND_STATUS;
+    }
+    else if (string_compare(verb.c_str(), "quit") == 0 || string_compare(verb.c_str(), "exit") == 0)
+    {
+        command->type = SESSION_COMMAND_QUIT;
+    }
+    else
+    {
+        *error = "Unknown command: " + verb;
+        return false;
+    }
+    return true;
+}
+
+void session_command_queue::push(const session_command_t &command)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_commands.push_back(command);
+}
+
+bool session_command_queue::try_pop(session_command_t *command)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_commands.empty())
+    {
+        return false;
+    }
+    *command = m_commands.front();
+    m_commands.pop_front();
+    return true;
+}
+
+void start_stdin_command_reader(std::shared_ptr<session_command_queue> queue, bool quit_on_eof)
+{
+    std::thread([queue, quit_on_eof]() {
+        std::string line;
+        while (std::getline(std::cin, line))
+        {
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+            {
+                continue;
+            }
+
+            session_command_t command;
+            std::string error;
+            if (parse_session_command(line, &command, &error))
+            {
+                queue->push(command);
+            }
+            else
+            {
+                std::cerr << error << std::endl;
+            }
+        }
+
+        if (quit_on_eof)
+        {
+            session_command_t quit;
+            parse_session_command("quit", &quit, NULL);
+            queue->push(quit);
+        }
+    }).detach();
+}
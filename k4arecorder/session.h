@@ -0,0 +1,59 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+typedef enum
+{
+    SESSION_COMMAND_ARM,
+    SESSION_COMMAND_START,
+    SESSION_COMMAND_STOP,
+    SESSION_COMMAND_STATUS,
+    SESSION_COMMAND_QUIT
+} session_command_type_t;
+
+typedef struct
+{
+    session_command_type_t type;
+    // Output file for arm, and for start without a previous arm.
+    std::string filename;
+    int recording_length;
+    std::chrono::steady_clock::time_point received;
+    // Sends one response line back to whoever issued the command; empty for stdin, where responses are printed.
+    std::function<void(const std::string &)> reply;
+} session_command_t;
+
+// Parses one command line of the session protocol:
+//   arm <output.mkv> [seconds]     create the file and write its header, ready to start
+//   start [<output.mkv> [seconds]] start the armed take, or arm and start a new one
+//   stop | status | quit
+// Output file names are relative to the session's output directory: absolute paths and ".." are rejected, as
+// commands may come from anywhere on the rig network. Returns false and sets error for malformed commands.
+bool parse_session_command(const std::string &line, session_command_t *command, std::string *error);
+
+// Commands handed from reader threads to the recording loop, which polls it once per frame.
+class session_command_queue
+{
+public:
+    void push(const session_command_t &command);
+    bool try_pop(session_command_t *command);
+
+private:
+    std::mutex m_mutex;
+    std::deque<session_command_t> m_commands;
+};
+
+// Starts a detached thread that reads commands from stdin. End of input is treated as "quit" if quit_on_eof is set,
+// otherwise (e.g. when a control server also feeds the queue) the thread just ends. The thread shares ownership of
+// the queue, as it can outlive the session.
+void start_stdin_command_reader(std::shared_ptr<session_command_queue> queue, bool quit_on_eof);
+
+#endif /* SESSION_H */
@@ -0,0 +1,609 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "soak.h"
+#include "capture_source.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#if !defined(_WIN32)
+#include <dirent.h>
+#endif
+
+static const uint64_t latencyBucketUsec = 10;
+static const size_t latencyBucketCount = 10000;
+
+latency_histogram::latency_histogram() : m_buckets(latencyBucketCount, 0), m_count(0), m_max_usec(0) {}
+
+void latency_histogram::add(uint64_t usec)
+{
+    size_t bucket = (size_t)(usec / latencyBucketUsec);
+    m_buckets[bucket < latencyBucketCount ? bucket : latencyBucketCount - 1]++;
+    m_count++;
+    if (usec > m_max_usec)
+    {
+        m_max_usec = usec;
+    }
+}
+
+uint64_t latency_histogram::percentile_usec(double fraction) const
+{
+    if (m_count == 0)
+    {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(fraction * (double)m_count + 0.5);
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < latencyBucketCount - 1; bucket++)
+    {
+        seen += m_buckets[bucket];
+        if (seen >= target)
+        {
+            return (bucket + 1) * latencyBucketUsec;
+        }
+    }
+    return m_max_usec;
+}
+
+bool get_process_usage(process_usage_t *usage)
+{
+#if defined(_WIN32)
+    (void)usage; // Unused
+    return false;
+#else
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status == NULL)
+    {
+        return false;
+    }
+    usage->rss_kb = 0;
+    usage->peak_rss_kb = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        unsigned long long kb;
+        if (sscanf(line, "VmRSS: %llu kB", &kb) == 1)
+        {
+            usage->rss_kb = kb;
+        }
+        else if (sscanf(line, "VmHWM: %llu kB", &kb) == 1)
+        {
+            usage->peak_rss_kb = kb;
+        }
+    }
+    fclose(status);
+
+    DIR *fds = opendir("/proc/self/fd");
+    if (fds == NULL)
+    {
+        return false;
+    }
+    // Not counting ".", ".." and the descriptor of the listing itself.
+    usage->open_fds = -3;
+    while (readdir(fds) != NULL)
+    {
+        usage->open_fds++;
+    }
+    closedir(fds);
+    return true;
+#endif
+}
+
+// Splits "key=value,key=value" into a map; false if an item has no '='.
+static bool parse_key_values(const char *str, std::map<std::string, std::string> *values)
+{
+    std::istringstream items(str);
+    std::string item;
+    while (std::getline(items, item, ','))
+    {
+        size_t equals = item.find('=');
+        if (equals == std::string::npos)
+        {
+            return false;
+        }
+        (*values)[item.substr(0, equals)] = item.substr(equals + 1);
+    }
+    return true;
+}
+
+void init_soak_budget(soak_budget_t *budget)
+{
+    budget->p99_write_ms = 20;
+    budget->max_write_ms = 500;
+    budget->rss_growth_mb = 64;
+    budget->fd_growth = 0;
+    budget->live_images = 0;
+}
+
+bool parse_soak_budget(const char *str, soak_budget_t *budget)
+{
+    std::map<std::string, std::string> values;
+    if (!parse_key_values(str, &values))
+    {
+        return false;
+    }
+    for (const auto &value : values)
+    {
+        char *end = NULL;
+        unsigned long parsed = strtoul(value.second.c_str(), &end, 10);
+        if (end == value.second.c_str() || *end != '\0' || value.second[0] == '-' || parsed > UINT32_MAX)
+        {
+            return false;
+        }
+        if (value.first == "p99_write_ms")
+        {
+            budget->p99_write_ms = (uint32_t)parsed;
+        }
+        else if (value.first == "max_write_ms")
+        {
+            budget->max_write_ms = (uint32_t)parsed;
+        }
+        else if (value.first == "rss_growth_mb")
+        {
+            budget->rss_growth_mb = (uint32_t)parsed;
+        }
+        else if (value.first == "fd_growth")
+        {
+            budget->fd_growth = (uint32_t)parsed;
+        }
+        else if (value.first == "live_images")
+        {
+            budget->live_images = (uint32_t)parsed;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+#if defined(_WIN32)
+
+int run_soak(const char *recorder_path,
+             const std::vector<std::string> &recorder_args,
+             const char *recording_filename,
+             uint32_t duration_s,
+             uint32_t seed,
+             const soak_budget_t *budget)
+{
+    (void)recorder_path;      // Unused
+    (void)recorder_args;      // Unused
+    (void)recording_filename; // Unused
+    (void)duration_s;         // Unused
+    (void)seed;               // Unused
+    (void)budget;             // Unused
+    std::cerr << "Soak runs are not supported on Windows." << std::endl;
+    return 1;
+}
+
+#else
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <iomanip>
+#include <random>
+
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// A run that has not exited this long after its planned end is hung.
+static const int soakHangTimeoutSec = 30;
+// Second SIGINT of a forced stop, after the one second the recorder waits for itself to finish.
+static const int soakForceDelayMs = 1500;
+static const uint32_t soakStopStallMs = 5000;
+static const uint32_t soakLateStopStallMs = 2000;
+static const uint32_t soakMaxTakeSec = 60;
+static const size_t soakOutputTailLines = 20;
+
+typedef enum
+{
+    // Runs for a random length; ends with status 0, or 1 if an injected wait failure ended it.
+    SOAK_TAKE,
+    // Stopped by one SIGINT during startup or recording; ends with status 0.
+    SOAK_INTERRUPT,
+    // Runs for a random length and gets one SIGINT while it saves; ends with status 0, as for SOAK_TAKE.
+    SOAK_LATE_INTERRUPT,
+    // Shutdown hangs, a second SIGINT forces exit status 1.
+    SOAK_FORCED_STOP
+} soak_scenario_t;
+
+static const char *soak_scenario_name(soak_scenario_t scenario)
+{
+    switch (scenario)
+    {
+    case SOAK_TAKE:
+        return "take";
+    case SOAK_INTERRUPT:
+        return "interrupt";
+    case SOAK_LATE_INTERRUPT:
+        return "late-interrupt";
+    default:
+        return "forced-stop";
+    }
+}
+
+typedef struct
+{
+    pid_t pid;
+    int output_fd;
+    std::string partial_line;
+    std::vector<std::string> tail;
+    std::map<std::string, std::string> report;
+    bool have_report;
+    bool started;
+    bool saving;
+    bool forced;
+    std::chrono::steady_clock::time_point first_output;
+    std::chrono::steady_clock::time_point recording_started;
+} soak_child_t;
+
+static bool spawn_recorder(const char *recorder_path, const std::vector<std::string> &args, soak_child_t *child)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        std::cerr << "Runtime error: pipe() failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        std::cerr << "Runtime error: fork() failed: " << strerror(errno) << std::endl;
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        std::vector<char *> argv;
+        argv.push_back((char *)recorder_path);
+        for (const std::string &arg : args)
+        {
+            argv.push_back((char *)arg.c_str());
+        }
+        argv.push_back(NULL);
+        execvp(recorder_path, argv.data());
+        _exit(127);
+    }
+    close(fds[1]);
+    child->pid = pid;
+    child->output_fd = fds[0];
+    return true;
+}
+
+static void handle_output_line(soak_child_t *child, const std::string &line)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (child->tail.empty())
+    {
+        child->first_output = now;
+    }
+    if (!child->started && line.compare(0, 17, "Started recording") == 0)
+    {
+        child->started = true;
+        child->recording_started = now;
+    }
+    if (line == "Saving recording...")
+    {
+        child->saving = true;
+    }
+    if (line == "Forcing stop.")
+    {
+        child->forced = true;
+    }
+    if (line.compare(0, 5, "SOAK ") == 0)
+    {
+        std::istringstream fields(line.substr(5));
+        std::string field;
+        while (fields >> field)
+        {
+            size_t equals = field.find('=');
+            if (equals != std::string::npos)
+            {
+                child->report[field.substr(0, equals)] = field.substr(equals + 1);
+            }
+        }
+        child->have_report = true;
+    }
+    child->tail.push_back(line);
+    if (child->tail.size() > soakOutputTailLines)
+    {
+        child->tail.erase(child->tail.begin());
+    }
+}
+
+// Reads whatever output is available within timeout_ms. Returns false at end of output.
+static bool read_output(soak_child_t *child, int timeout_ms)
+{
+    struct pollfd fd;
+    fd.fd = child->output_fd;
+    fd.events = POLLIN;
+    if (poll(&fd, 1, timeout_ms) <= 0)
+    {
+        return true;
+    }
+    char buffer[4096];
+    ssize_t size = read(child->output_fd, buffer, sizeof(buffer));
+    if (size <= 0)
+    {
+        return false;
+    }
+    for (ssize_t i = 0; i < size; i++)
+    {
+        if (buffer[i] == '\n')
+        {
+            handle_output_line(child, child->partial_line);
+            child->partial_line.clear();
+        }
+        else
+        {
+            child->partial_line += buffer[i];
+        }
+    }
+    return true;
+}
+
+static uint64_t report_value(const soak_child_t *child, const char *key)
+{
+    auto value = child->report.find(key);
+    return value == child->report.end() ? 0 : strtoull(value->second.c_str(), NULL, 10);
+}
+
+// Checks the run's exit and report; returns an empty string if it passed.
+static std::string check_run(soak_scenario_t scenario,
+                             const soak_child_t *child,
+                             int wait_status,
+                             bool hung,
+                             const soak_budget_t *budget)
+{
+    std::ostringstream failure;
+    if (hung)
+    {
+        failure << "did not exit within " << soakHangTimeoutSec << " s of its planned end";
+        return failure.str();
+    }
+    if (!WIFEXITED(wait_status))
+    {
+        failure << "killed by signal " << WTERMSIG(wait_status);
+        return failure.str();
+    }
+
+    int status = WEXITSTATUS(wait_status);
+    if (scenario == SOAK_FORCED_STOP)
+    {
+        if (status != 1 || !child->forced)
+        {
+            failure << "second SIGINT did not force the exit (status " << status << ")";
+        }
+        return failure.str();
+    }
+    if (child->forced)
+    {
+        failure << "a single SIGINT forced the exit";
+        return failure.str();
+    }
+    if (!child->have_report)
+    {
+        failure << "exited with status " << status << " without a soak report";
+        return failure.str();
+    }
+    bool wait_failed = report_value(child, "wait_failures") > 0;
+    if (status != 0 && !(status == 1 && wait_failed))
+    {
+        failure << "exited with status " << status;
+    }
+    else if (report_value(child, "write_p99_us") > (uint64_t)budget->p99_write_ms * 1000)
+    {
+        failure << "write p99 " << report_value(child, "write_p99_us") << " us over the budget";
+    }
+    else if (report_value(child, "write_max_us") > (uint64_t)budget->max_write_ms * 1000)
+    {
+        failure << "longest write " << report_value(child, "write_max_us") << " us over the budget";
+    }
+    else if (report_value(child, "rss_growth_kb") > (uint64_t)budget->rss_growth_mb * 1024)
+    {
+        failure << "RSS grew by " << report_value(child, "rss_growth_kb") << " kB";
+    }
+    else if (report_value(child, "fd_growth") > budget->fd_growth)
+    {
+        failure << report_value(child, "fd_growth") << " file descriptors leaked";
+    }
+    else if (report_value(child, "live_images") > budget->live_images)
+    {
+        failure << report_value(child, "live_images") << " images never released";
+    }
+    return failure.str();
+}
+
+int run_soak(const char *recorder_path,
+             const std::vector<std::string> &recorder_args,
+             const char *recording_filename,
+             uint32_t duration_s,
+             uint32_t seed,
+             const soak_budget_t *budget)
+{
+    std::mt19937 random(seed);
+    auto chance = [&random](double probability) {
+        return std::uniform_real_distribution<double>(0.0, 1.0)(random) < probability;
+    };
+    std::cout << "Soak run for " << duration_s << " s, seed " << seed << std::endl;
+
+    auto soak_end = std::chrono::steady_clock::now() + std::chrono::seconds(duration_s);
+    int runs = 0;
+    int failures = 0;
+    uint64_t worst_p99_us = 0;
+    uint64_t worst_rss_growth_kb = 0;
+    while (std::chrono::steady_clock::now() < soak_end)
+    {
+        double scenario_roll = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+        soak_scenario_t scenario = SOAK_FORCED_STOP;
+        if (scenario_roll < 0.4)
+        {
+            scenario = SOAK_TAKE;
+        }
+        else if (scenario_roll < 0.55)
+        {
+            scenario = SOAK_LATE_INTERRUPT;
+        }
+        else if (scenario_roll < 0.85)
+        {
+            scenario = SOAK_INTERRUPT;
+        }
+        uint32_t length_s = std::uniform_int_distribution<uint32_t>(5, soakMaxTakeSec)(random);
+
+        fault_injection_t faults;
+        parse_fault_injection("none", &faults);
+        faults.seed = (uint32_t)random();
+        if (chance(0.5))
+        {
+            faults.slow_write = 0.005;
+            faults.slow_write_ms = std::uniform_int_distribution<uint32_t>(50, 500)(random);
+        }
+        if (scenario == SOAK_TAKE && chance(0.2))
+        {
+            faults.wait_failed = 0.002;
+        }
+        if (chance(0.3))
+        {
+            faults.timestamp_jump = 0.002;
+        }
+        if (chance(0.5))
+        {
+            faults.imu_reorder = 0.02;
+        }
+        if (scenario == SOAK_FORCED_STOP)
+        {
+            faults.stop_stall_ms = soakStopStallMs;
+        }
+        else if (scenario == SOAK_LATE_INTERRUPT)
+        {
+            // Keeps the recorder shutting down for a while after the SIGINT, so a wrongly forced exit shows.
+            faults.stop_stall_ms = soakLateStopStallMs;
+        }
+
+        // The IMU goes first so that recorder_args can turn it off again.
+        std::vector<std::string> args = { "--imu", "ON" };
+        args.insert(args.end(), recorder_args.begin(), recorder_args.end());
+        args.push_back("--synthetic");
+        args.push_back("--inject-faults");
+        args.push_back(format_fault_injection(&faults));
+        if (scenario == SOAK_TAKE || scenario == SOAK_LATE_INTERRUPT)
+        {
+            args.push_back("-l");
+            args.push_back(std::to_string(length_s));
+        }
+        args.push_back(recording_filename);
+
+        // Interrupts hit startup a quarter of the time, otherwise a random point of the take.
+        bool interrupt_startup = scenario == SOAK_INTERRUPT && chance(0.25);
+        auto interrupt_delay = std::chrono::milliseconds(
+            interrupt_startup ? std::uniform_int_distribution<int>(0, 300)(random) :
+                                std::uniform_int_distribution<int>(500, (int)length_s * 1000)(random));
+
+        soak_child_t child;
+        child.have_report = false;
+        child.started = false;
+        child.saving = false;
+        child.forced = false;
+        if (!spawn_recorder(recorder_path, args, &child))
+        {
+            return 1;
+        }
+
+        auto run_start = std::chrono::steady_clock::now();
+        auto deadline = run_start + std::chrono::seconds(length_s + soakHangTimeoutSec);
+        int interrupts_sent = 0;
+        std::chrono::steady_clock::time_point first_interrupt;
+        bool hung = false;
+        while (read_output(&child, 100))
+        {
+            auto now = std::chrono::steady_clock::now();
+            if (scenario == SOAK_LATE_INTERRUPT && interrupts_sent == 0 && child.saving)
+            {
+                kill(child.pid, SIGINT);
+                interrupts_sent++;
+            }
+            else if ((scenario == SOAK_INTERRUPT || scenario == SOAK_FORCED_STOP) && interrupts_sent == 0)
+            {
+                // Only once the recorder printed something, so its SIGINT handler is installed.
+                bool ready = interrupt_startup ? !child.tail.empty() : child.started;
+                auto since = interrupt_startup ? child.first_output : child.recording_started;
+                if (ready && now - since >= interrupt_delay)
+                {
+                    kill(child.pid, SIGINT);
+                    interrupts_sent++;
+                    first_interrupt = now;
+                    deadline = now + std::chrono::seconds(soakHangTimeoutSec);
+                }
+            }
+            else if (scenario == SOAK_FORCED_STOP && interrupts_sent == 1 &&
+                     now - first_interrupt >= std::chrono::milliseconds(soakForceDelayMs))
+            {
+                kill(child.pid, SIGINT);
+                interrupts_sent++;
+            }
+            if (now > deadline)
+            {
+                hung = true;
+                kill(child.pid, SIGKILL);
+            }
+        }
+        if (!child.partial_line.empty())
+        {
+            handle_output_line(&child, child.partial_line);
+        }
+        close(child.output_fd);
+        int wait_status = 0;
+        waitpid(child.pid, &wait_status, 0);
+
+        runs++;
+        double run_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count();
+        std::string failure = check_run(scenario, &child, wait_status, hung, budget);
+        std::cout << "Run " << runs << " " << soak_scenario_name(scenario) << " " << std::fixed
+                  << std::setprecision(1) << run_seconds << " s: " << (failure.empty() ? "ok" : "FAILED");
+        if (child.have_report)
+        {
+            uint64_t p99_us = report_value(&child, "write_p99_us");
+            uint64_t rss_growth_kb = report_value(&child, "rss_growth_kb");
+            worst_p99_us = std::max(worst_p99_us, p99_us);
+            worst_rss_growth_kb = std::max(worst_rss_growth_kb, rss_growth_kb);
+            std::cout << " frames=" << report_value(&child, "frames") << " drops=" << report_value(&child, "drops")
+                      << " write_p99=" << p99_us / 1000.0 << "ms rss_growth=" << rss_growth_kb << "kB";
+        }
+        std::cout << " faults=" << format_fault_injection(&faults) << std::endl;
+        if (!failure.empty())
+        {
+            failures++;
+            std::cout << "  " << failure << std::endl << "  command: " << recorder_path;
+            for (const std::string &arg : args)
+            {
+                std::cout << " " << arg;
+            }
+            std::cout << std::endl;
+            for (const std::string &line : child.tail)
+            {
+                std::cout << "  | " << line << std::endl;
+            }
+        }
+    }
+
+    std::cout << "Soak: " << runs << " runs, " << failures << " failed, worst write p99 " << std::fixed
+              << std::setprecision(1) << worst_p99_us / 1000.0 << " ms, worst RSS growth " << worst_rss_growth_kb
+              << " kB" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
+
+#endif
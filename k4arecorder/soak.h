@@ -0,0 +1,81 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef SOAK_H
+#define SOAK_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Histogram of latencies in 10 us buckets up to 100 ms; longer ones go to the last bucket. Its size is fixed, so a
+// take of any length can keep one.
+class latency_histogram
+{
+public:
+    latency_histogram();
+
+    void add(uint64_t usec);
+
+    uint64_t count() const
+    {
+        return m_count;
+    }
+    uint64_t max_usec() const
+    {
+        return m_max_usec;
+    }
+
+    // Upper bound of the bucket that holds the given fraction (0-1) of the samples, 0 without samples.
+    uint64_t percentile_usec(double fraction) const;
+
+private:
+    std::vector<uint32_t> m_buckets;
+    uint64_t m_count;
+    uint64_t m_max_usec;
+};
+
+typedef struct
+{
+    uint64_t rss_kb;
+    uint64_t peak_rss_kb;
+    int open_fds;
+} process_usage_t;
+
+// Reads the resident set size and open file descriptors of this process from /proc/self. Returns false where that
+// is not available.
+bool get_process_usage(process_usage_t *usage);
+
+// Limits every soak run is checked against.
+typedef struct
+{
+    // Time to write one capture (write_capture() and its metadata row), without injected stalls.
+    uint32_t p99_write_ms;
+    uint32_t max_write_ms;
+    // Resident set growth from two seconds into the take to its end.
+    uint32_t rss_growth_mb;
+    // Descriptors and synthetic images still open after the device was closed.
+    uint32_t fd_growth;
+    uint32_t live_images;
+} soak_budget_t;
+
+void init_soak_budget(soak_budget_t *budget);
+
+// Parses comma separated key=value pairs named like the fields, for example "p99_write_ms=10,rss_growth_mb=32".
+bool parse_soak_budget(const char *str, soak_budget_t *budget);
+
+// Runs the recorder at recorder_path over and over for duration_s seconds, each time with the synthetic source,
+// random injected faults (see fault_injection_t) and recorder_args, writing recording_filename. A run is a take of
+// random length, one that also gets a SIGINT while it saves, a take stopped by SIGINT at a random point, or a take
+// whose shutdown hangs so that a second SIGINT has to force the exit. Each run must end the way its scenario expects
+// within a deadline, and its soak report must stay within the budget. Prints one line per run and a summary; returns
+// 0 if every run passed.
+int run_soak(const char *recorder_path,
+             const std::vector<std::string> &recorder_args,
+             const char *recording_filename,
+             uint32_t duration_s,
+             uint32_t seed,
+             const soak_budget_t *budget);
+
+#endif /* SOAK_H */
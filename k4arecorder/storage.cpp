@@ -0,0 +1,327 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "storage.h"
+#include "roi.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/statvfs.h>
+#include <unistd.h>
+#endif
+
+// A compressed MJPG frame rarely exceeds a quarter byte per pixel, even for detailed scenes.
+static const uint64_t mjpgPixelsPerByte = 4;
+// The IMU delivers about 1.6 kHz of samples, each stored as a small block.
+static const uint64_t imuBytesPerSecond = 1600 * 64;
+// Write probe: up to this many bytes, but stop after probeMaxSeconds on slow media.
+static const size_t probeBytes = 32 * 1024 * 1024;
+static const size_t probeChunkBytes = 1024 * 1024;
+static const double probeMaxSeconds = 2.0;
+// The filesystem must sustain the estimated rate with this much headroom.
+static const double bandwidthHeadroom = 1.25;
+// Without a recording length, a take needs room for at least this long.
+static const int admissionMinSeconds = 60;
+static const double monitorWarnSeconds = 60.0;
+static const double monitorPollSeconds = 1.0;
+// Time allowed for the writes still queued when the recorder is stopped and for finalizing the file.
+static const double monitorFlushSeconds = 2.0;
+
+// Directory part of a path, "." for bare file names.
+static std::string directory_of(const char *path)
+{
+    std::string str(path);
+    size_t slash = str.find_last_of("/\\");
+    if (slash == std::string::npos)
+    {
+        return ".";
+    }
+    return slash == 0 ? str.substr(0, 1) : str.substr(0, slash);
+}
+
+bool get_free_disk_space(const char *path, uint64_t *free_bytes)
+{
+    std::string directory = directory_of(path);
+#if defined(_WIN32)
+    ULARGE_INTEGER available;
+    if (!GetDiskFreeSpaceExA(directory.c_str(), &available, NULL, NULL))
+    {
+        return false;
+    }
+    *free_bytes = available.QuadPart;
+#else
+    struct statvfs stats;
+    if (statvfs(directory.c_str(), &stats) != 0)
+    {
+        return false;
+    }
+    *free_bytes = (uint64_t)stats.f_bavail * stats.f_frsize;
+#endif
+    return true;
+}
+
+uint64_t estimate_recording_bytes_per_second(const recorder_config_t *config)
+{
+    const k4a_device_configuration_t *device_config = &config->device_config;
+    uint64_t frame_bytes = 0;
+    int width, height;
+
+    if (get_depth_mode_size(device_config->depth_mode, &width, &height))
+    {
+        uint64_t pixels = config->roi.depth_enabled ? (uint64_t)config->roi.depth.width * config->roi.depth.height :
+                                                      (uint64_t)width * height;
+        if (device_config->depth_mode != K4A_DEPTH_MODE_PASSIVE_IR)
+        {
+            frame_bytes += pixels * sizeof(uint16_t);
+        }
+        switch (config->ir_mode)
+        {
+        case IR_MODE_OFF:
+            break;
+        case IR_MODE_HALF:
+            frame_bytes += pixels / 4 * sizeof(uint16_t);
+            break;
+        case IR_MODE_COMPRESSED:
+            frame_bytes += pixels;
+            break;
+        default:
+            frame_bytes += pixels * sizeof(uint16_t);
+            break;
+        }
+    }
+
+    if (get_color_resolution_size(device_config->color_resolution, &width, &height))
+    {
+        uint64_t pixels = config->roi.color_enabled && roi_supports_format(device_config->color_format) ?
+                              (uint64_t)config->roi.color.width * config->roi.color.height :
+                              (uint64_t)width * height;
+        switch (device_config->color_format)
+        {
+        case K4A_IMAGE_FORMAT_COLOR_MJPG:
+            frame_bytes += pixels / mjpgPixelsPerByte;
+            break;
+        case K4A_IMAGE_FORMAT_COLOR_NV12:
+            frame_bytes += pixels * 3 / 2;
+            break;
+        case K4A_IMAGE_FORMAT_COLOR_YUY2:
+            frame_bytes += pixels * 2;
+            break;
+        default:
+            frame_bytes += pixels * 4;
+            break;
+        }
+    }
+
+    uint64_t bytes_per_second = frame_bytes * k4a_convert_fps_to_uint(device_config->camera_fps);
+    if (config->record_imu)
+    {
+        bytes_per_second += imuBytesPerSecond;
+    }
+    // Matroska block and cluster overhead.
+    return bytes_per_second + bytes_per_second / 50;
+}
+
+static bool sync_file(FILE *file)
+{
+    if (fflush(file) != 0)
+    {
+        return false;
+    }
+#if defined(_WIN32)
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+bool probe_write_bandwidth(const char *path, double *bytes_per_second)
+{
+    static std::map<std::string, double> probed;
+
+    std::string directory = directory_of(path);
+    auto cached = probed.find(directory);
+    if (cached != probed.end())
+    {
+        *bytes_per_second = cached->second;
+        return true;
+    }
+
+    std::string probe_path = directory + "/.k4arecorder-write-probe";
+    FILE *file = fopen(probe_path.c_str(), "wb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    // Incompressible-looking data, in case the filesystem compresses.
+    std::vector<uint8_t> chunk(probeChunkBytes);
+    uint32_t state = 0x12345678;
+    for (uint8_t &byte : chunk)
+    {
+        state = state * 1664525 + 1013904223;
+        byte = (uint8_t)(state >> 24);
+    }
+
+    bool ok = true;
+    size_t written = 0;
+    auto start = std::chrono::steady_clock::now();
+    double seconds = 0;
+    while (ok && written < probeBytes && seconds < probeMaxSeconds)
+    {
+        ok = fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size() && sync_file(file);
+        written += chunk.size();
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    fclose(file);
+    std::remove(probe_path.c_str());
+
+    if (!ok || seconds <= 0)
+    {
+        return false;
+    }
+    *bytes_per_second = written / seconds;
+    probed[directory] = *bytes_per_second;
+    return true;
+}
+
+static double to_mb(double bytes)
+{
+    return bytes / (1024 * 1024);
+}
+
+int check_storage_admission(const recorder_config_t *config, const char *recording_filename, int recording_length)
+{
+    if (config->storage_check == STORAGE_CHECK_OFF)
+    {
+        return 0;
+    }
+
+    uint64_t required_rate = estimate_recording_bytes_per_second(config);
+    uint64_t reserve_bytes = (uint64_t)config->min_free_mb * 1024 * 1024;
+    int seconds = recording_length > 0 ? recording_length : admissionMinSeconds;
+    double bandwidth = 0;
+    bool bandwidth_known = probe_write_bandwidth(recording_filename, &bandwidth);
+    uint64_t free_bytes = 0;
+    bool free_known = get_free_disk_space(recording_filename, &free_bytes);
+
+    std::cout << std::fixed << std::setprecision(1) << "Storage: estimated " << to_mb(required_rate) << " MB/s, ";
+    if (bandwidth_known)
+    {
+        std::cout << "filesystem writes " << to_mb(bandwidth) << " MB/s, ";
+    }
+    if (free_known)
+    {
+        std::cout << to_mb(free_bytes) << " MB free";
+        if (free_bytes > reserve_bytes && required_rate > 0)
+        {
+            std::cout << " (about " << (double)(free_bytes - reserve_bytes) / required_rate / 60 << " min)";
+        }
+    }
+    std::cout << std::endl;
+
+    std::vector<std::string> problems;
+    if (!bandwidth_known)
+    {
+        problems.push_back("unable to measure the write speed of " + directory_of(recording_filename));
+    }
+    else if (bandwidth < required_rate * bandwidthHeadroom)
+    {
+        problems.push_back("the filesystem cannot sustain the estimated data rate");
+    }
+    if (free_known && free_bytes < reserve_bytes + required_rate * (uint64_t)seconds)
+    {
+        std::ostringstream str;
+        str << "not enough free space for " << seconds << " s of recording above the " << config->min_free_mb
+            << " MB reserve";
+        problems.push_back(str.str());
+    }
+
+    for (const std::string &problem : problems)
+    {
+        std::cerr << (config->storage_check == STORAGE_CHECK_REFUSE ? "Refusing to record: " : "Warning: ")
+                  << problem << std::endl;
+    }
+    return config->storage_check == STORAGE_CHECK_REFUSE && !problems.empty() ? 1 : 0;
+}
+
+storage_monitor::storage_monitor() :
+    m_reserve_bytes(0),
+    m_last_free_bytes(0),
+    m_bytes_per_second(0),
+    m_seconds_to_full(-1),
+    m_warned(false),
+    m_ok(true)
+{
+}
+
+void storage_monitor::start(const char *recording_filename, uint32_t min_free_mb, uint64_t expected_bytes_per_second)
+{
+    m_path = recording_filename;
+    m_reserve_bytes = (uint64_t)min_free_mb * 1024 * 1024;
+    m_last_poll = std::chrono::steady_clock::now();
+    m_bytes_per_second = (double)expected_bytes_per_second;
+    m_seconds_to_full = -1;
+    m_warned = false;
+    m_ok = get_free_disk_space(m_path.c_str(), &m_last_free_bytes) ? m_last_free_bytes > stop_bytes() : true;
+    if (!m_ok)
+    {
+        std::cerr << "Less than " << stop_bytes() / (1024 * 1024) << " MB free for " << m_path
+                  << ", stopping the recording." << std::endl;
+        m_seconds_to_full = 0;
+    }
+}
+
+uint64_t storage_monitor::stop_bytes() const
+{
+    return std::max(m_reserve_bytes, (uint64_t)(m_bytes_per_second * (monitorPollSeconds + monitorFlushSeconds)));
+}
+
+bool storage_monitor::poll()
+{
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - m_last_poll).count();
+    if (!m_ok || elapsed < monitorPollSeconds)
+    {
+        return m_ok;
+    }
+
+    uint64_t free_bytes;
+    if (!get_free_disk_space(m_path.c_str(), &free_bytes))
+    {
+        return m_ok;
+    }
+    if (free_bytes < m_last_free_bytes)
+    {
+        double rate = (m_last_free_bytes - free_bytes) / elapsed;
+        m_bytes_per_second = m_bytes_per_second == 0 ? rate : 0.8 * m_bytes_per_second + 0.2 * rate;
+    }
+    m_last_free_bytes = free_bytes;
+    m_last_poll = now;
+
+    uint64_t stop_at = stop_bytes();
+    if (free_bytes <= stop_at)
+    {
+        std::cerr << "Less than " << stop_at / (1024 * 1024) << " MB free for " << m_path
+                  << ", stopping the recording." << std::endl;
+        m_seconds_to_full = 0;
+        m_ok = false;
+        return false;
+    }
+    m_seconds_to_full = m_bytes_per_second > 0 ? (free_bytes - stop_at) / m_bytes_per_second : -1;
+    if (!m_warned && m_seconds_to_full >= 0 && m_seconds_to_full < monitorWarnSeconds)
+    {
+        std::cerr << "Warning: the disk will be full in about " << (int)m_seconds_to_full << " s" << std::endl;
+        m_warned = true;
+    }
+    return true;
+}
@@ -0,0 +1,67 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stdint.h>
+
+#include <chrono>
+#include <string>
+
+#include "recorder.h"
+
+// Free space available to the recorder on the filesystem that holds path (a file or directory, which need not
+// exist yet). Returns false if it cannot be determined.
+bool get_free_disk_space(const char *path, uint64_t *free_bytes);
+
+// Bytes per second a take with this configuration writes, from the camera modes, frame rate and pixel ROIs. MJPG
+// color is estimated at a conservative compression ratio, so this is an upper bound for typical scenes.
+uint64_t estimate_recording_bytes_per_second(const recorder_config_t *config);
+
+// Measures sustained write speed on the filesystem that holds path by writing and syncing a temporary file next to
+// it. The result is cached per directory for the lifetime of the process. Returns false if the probe failed.
+bool probe_write_bandwidth(const char *path, double *bytes_per_second);
+
+// Checks, before a take is created, that the filesystem can keep up with the estimated data rate and has room for
+// recording_length seconds (or at least a minute if it is not positive) above the reserve. Depending on
+// config->storage_check a shortfall is only reported or refuses the take. Returns 0 if the take may start.
+int check_storage_admission(const recorder_config_t *config, const char *recording_filename, int recording_length);
+
+// Watches free space on the recording's filesystem about once per second while a take runs, warns when the disk is
+// projected to fill within a minute and tells the recorder to stop while the reserve is still free, so the file can
+// be finalized. The recorder is stopped early enough that, at the current write rate, the data written until the
+// next poll and while finalizing also fits above the reserve.
+class storage_monitor
+{
+public:
+    storage_monitor();
+
+    // expected_bytes_per_second (see estimate_recording_bytes_per_second()) stands in for the write rate until it
+    // has been measured.
+    void start(const char *recording_filename, uint32_t min_free_mb, uint64_t expected_bytes_per_second);
+
+    // Returns false once the free space dropped below the stop threshold.
+    bool poll();
+
+    // Seconds until the stop threshold is reached at the current write rate, or -1 if unknown.
+    double seconds_to_full() const
+    {
+        return m_seconds_to_full;
+    }
+
+private:
+    // Free space at which the recorder is stopped: the reserve, or more at high write rates.
+    uint64_t stop_bytes() const;
+
+    std::string m_path;
+    uint64_t m_reserve_bytes;
+    uint64_t m_last_free_bytes;
+    std::chrono::steady_clock::time_point m_last_poll;
+    double m_bytes_per_second;
+    double m_seconds_to_full;
+    bool m_warned;
+    bool m_ok;
+};
+
+#endif /* STORAGE_H */